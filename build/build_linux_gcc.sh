@@ -0,0 +1,34 @@
+#!/bin/sh
+
+# Gather arguments
+config=${1:-release}
+target=${2:-press}
+
+# Switch to project root directory
+cd "$(dirname "$0")/.." || exit 1
+
+# The main executable is built from the unity file, tools from their own source
+source=tools/$target.c
+if [ "$target" = "press" ]; then
+	source=src/unity.c
+fi
+
+# Create build output directory
+mkdir -p "build/linux_$config"
+
+optimization="-O2 -DNDEBUG"
+if [ "$config" = "debug" ]; then
+	optimization="-O0"
+elif [ "$config" = "instrumented" ]; then
+	optimization="$optimization -DPRESS_TRACK_ALLOCATIONS"
+fi
+
+# Invoke compiler
+${CC:-gcc} \
+	$optimization \
+	-g \
+	-std=c2x \
+	-Wall -Wno-unused-function -Wno-sign-compare -Wno-missing-braces \
+	-o "build/linux_$config/$target" \
+	"$source" \
+	-lpthread
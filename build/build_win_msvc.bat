@@ -2,6 +2,12 @@
 
 rem Gather arguments
 set config=%1
+set target=%2
+if "%target%"=="" set target=press
+
+rem The main executable is built from the unity file, tools from their own source
+set source=tools\%target%.c
+if "%target%"=="press" set source=src\unity.c
 
 setlocal EnableDelayedExpansion
 
@@ -57,6 +63,7 @@ mkdir "build\win_%config%\obj" 2>nul
 
 set optimization=/O2 /GL /D NDEBUG
 if %config%==debug set optimization=/Od
+if %config%==instrumented set optimization=/O2 /GL /D NDEBUG /D PRESS_TRACK_ALLOCATIONS
 
 rem Invoke compiler
 %vc_compiler% ^
@@ -66,12 +73,12 @@ rem Invoke compiler
 /Oi /GS- /DYNAMICBASE:NO /fp:fast /Gv /diagnostics:caret ^
 /nologo ^
 /D _CRT_SECURE_NO_WARNINGS ^
-/Fd"build\win_%config%\press.pdb" ^
+/Fd"build\win_%config%\%target%.pdb" ^
 /Fo"build\win_%config%\obj\\" ^
-/Fe"build\win_%config%\press.exe" ^
-/Fm"build\win_%config%\press.map" ^
+/Fe"build\win_%config%\%target%.exe" ^
+/Fm"build\win_%config%\%target%.map" ^
 /I %vc_include% /I "%sdk_include%\um" /I "%sdk_include%\ucrt" /I "%sdk_include%\shared" ^
-"src\unity.c" /link /OPT:ref /subsystem:console /incremental:no libucrt.lib /LIBPATH:%vc_lib% /LIBPATH:%sdk_lib% /LIBPATH:%ucrt_lib%
+"%source%" /link /OPT:ref /subsystem:console /incremental:no libucrt.lib /LIBPATH:%vc_lib% /LIBPATH:%sdk_lib% /LIBPATH:%ucrt_lib%
 
 rem Switch back to calling directory
 popd
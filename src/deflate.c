@@ -0,0 +1,670 @@
+// https://www.rfc-editor.org/rfc/rfc1951
+
+enum
+{
+	deflate_window_size			= 1 << 15,
+	deflate_window_mask			= deflate_window_size - 1,
+	deflate_hash_bits			= 15,
+	deflate_hash_size			= 1 << deflate_hash_bits,
+	deflate_min_match			= 3,
+	deflate_max_match			= 258,
+	deflate_max_stored			= 65535,
+	deflate_block_symbols		= 1 << 14,
+	deflate_end_of_block		= 256,
+	deflate_litlen_count		= 286,
+	deflate_dist_count			= 30,
+	deflate_codelen_count		= 19,
+	deflate_max_code_bits		= 15,
+	deflate_max_codelen_bits	= 7
+};
+
+/*
+	Each level trades speed for compression by limiting how many earlier positions are checked for
+	a match, and below which length the next position is also checked for a longer match.
+*/
+typedef struct
+{
+	uint16_t	max_chain;
+	uint16_t	max_lazy;
+	uint16_t	nice_length;
+} deflate_level;
+
+static const deflate_level deflate_levels[10] = {
+	{    0,   0,   0 },	// Stored, handled by the caller
+	{    4,   0,   8 },
+	{    8,   0,  16 },
+	{   32,   0,  32 },
+	{   16,   4,  16 },
+	{   32,  16,  32 },
+	{  128,  16, 128 },
+	{  256,  32, 128 },
+	{ 1024, 128, 258 },
+	{ 4096, 258, 258 }
+};
+
+static const uint16_t deflate_length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t deflate_length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t deflate_dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+static const uint8_t deflate_dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const uint8_t deflate_codelen_order[deflate_codelen_count] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+typedef struct
+{
+	output_buffer*	out;
+	const uint8_t*	data;
+	uint32_t		size;
+	uint64_t		bits;
+	uint32_t		bit_count;
+
+	// Symbols for the current block. Literals have a distance of zero.
+	uint16_t		lengths[deflate_block_symbols];
+	uint16_t		dists[deflate_block_symbols];
+	uint32_t		symbol_count;
+	uint32_t		block_start;
+
+	uint32_t		litlen_freqs[deflate_litlen_count];
+	uint32_t		dist_freqs[deflate_dist_count];
+
+	uint8_t			length_code_lookup[deflate_max_match + 1];
+	uint8_t			dist_code_lookup[512];
+
+	// Most recent position for each hash, and the previous position with the same hash
+	int32_t			head[deflate_hash_size];
+	int32_t			prev[deflate_window_size];
+} deflate_context;
+
+static void deflate_put_bits(deflate_context* ctx, uint32_t value, uint32_t count)
+{
+	ctx->bits |= (uint64_t)value << ctx->bit_count;
+	ctx->bit_count += count;
+
+	if (ctx->bit_count >= 32)
+	{
+		char* dst = reserve_output(ctx->out, 4);
+		dst[0] = (char)(ctx->bits);
+		dst[1] = (char)(ctx->bits >> 8);
+		dst[2] = (char)(ctx->bits >> 16);
+		dst[3] = (char)(ctx->bits >> 24);
+		ctx->out->size += 4;
+
+		ctx->bits >>= 32;
+		ctx->bit_count -= 32;
+	}
+}
+
+// Writes out any remaining bits, padding the last byte with zeroes
+static void deflate_flush_bits(deflate_context* ctx)
+{
+	while (ctx->bit_count > 0)
+	{
+		*reserve_output(ctx->out, 1) = (char)ctx->bits;
+		++ctx->out->size;
+
+		ctx->bits >>= 8;
+		ctx->bit_count = ctx->bit_count > 8 ? ctx->bit_count - 8 : 0;
+	}
+
+	ctx->bits = 0;
+}
+
+static uint32_t deflate_get_dist_code(const deflate_context* ctx, uint32_t dist)
+{
+	return dist <= 256 ? ctx->dist_code_lookup[dist - 1] : ctx->dist_code_lookup[256 + ((dist - 1) >> 7)];
+}
+
+/*
+	Builds Huffman code lengths no longer than max_bits. Lengths come from a standard Huffman tree
+	built with two queues over the symbols sorted by frequency. Any that are too long are clamped,
+	then codes are moved down the tree until the lengths form a complete code again. Lengths are
+	handed out from shortest to longest in order of decreasing frequency.
+*/
+static void deflate_build_lengths(const uint32_t* freqs, uint32_t count, uint32_t max_bits, uint8_t* lengths)
+{
+	uint16_t symbols[deflate_litlen_count];
+	uint32_t symbol_count = 0;
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		lengths[i] = 0;
+
+		if (freqs[i])
+			symbols[symbol_count++] = (uint16_t)i;
+	}
+
+	if (symbol_count == 0)
+		return;
+
+	// Decoders require complete codes, so a lone symbol is paired with an unused one
+	if (symbol_count == 1)
+	{
+		lengths[symbols[0]] = 1;
+		lengths[symbols[0] == 0 ? 1 : 0] = 1;
+		return;
+	}
+
+	// Insertion sort is fine for at most 286 symbols
+	for (uint32_t i = 1; i < symbol_count; ++i)
+	{
+		const uint16_t symbol = symbols[i];
+		uint32_t j = i;
+
+		while (j > 0 && freqs[symbols[j - 1]] > freqs[symbol])
+		{
+			symbols[j] = symbols[j - 1];
+			--j;
+		}
+
+		symbols[j] = symbol;
+	}
+
+	uint32_t weights[deflate_litlen_count * 2];
+	uint16_t parents[deflate_litlen_count * 2];
+	uint16_t depths[deflate_litlen_count * 2];
+
+	for (uint32_t i = 0; i < symbol_count; ++i)
+		weights[i] = freqs[symbols[i]];
+
+	// Leaves are already sorted, and internal nodes are created in order of increasing weight
+	const uint32_t node_count = symbol_count * 2 - 1;
+	uint32_t leaf = 0;
+	uint32_t node = symbol_count;
+
+	for (uint32_t next = symbol_count; next < node_count; ++next)
+	{
+		uint32_t picks[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			if (leaf < symbol_count && (node >= next || weights[leaf] <= weights[node]))
+				picks[i] = leaf++;
+			else
+				picks[i] = node++;
+		}
+
+		weights[next] = weights[picks[0]] + weights[picks[1]];
+		parents[picks[0]] = (uint16_t)next;
+		parents[picks[1]] = (uint16_t)next;
+	}
+
+	depths[node_count - 1] = 0;
+	for (uint32_t i = node_count - 1; i-- > 0;)
+		depths[i] = depths[parents[i]] + 1;
+
+	uint32_t length_counts[deflate_max_code_bits + 1] = {};
+	for (uint32_t i = 0; i < symbol_count; ++i)
+		++length_counts[depths[i] < max_bits ? depths[i] : max_bits];
+
+	// Clamping can only make the code oversubscribed, so lengthen codes until it is complete
+	uint32_t total = 0;
+	for (uint32_t i = max_bits; i > 0; --i)
+		total += length_counts[i] << (max_bits - i);
+
+	while (total != (1u << max_bits))
+	{
+		--length_counts[max_bits];
+
+		for (uint32_t i = max_bits - 1; i > 0; --i)
+		{
+			if (length_counts[i])
+			{
+				--length_counts[i];
+				length_counts[i + 1] += 2;
+				break;
+			}
+		}
+
+		--total;
+	}
+
+	uint32_t symbol_index = symbol_count;
+	for (uint32_t bits = 1; bits <= max_bits; ++bits)
+	{
+		for (uint32_t i = length_counts[bits]; i > 0; --i)
+			lengths[symbols[--symbol_index]] = (uint8_t)bits;
+	}
+}
+
+// Assigns canonical codes, bit reversed since Huffman codes are written most significant bit first
+static void deflate_build_codes(const uint8_t* lengths, uint32_t count, uint16_t* codes)
+{
+	uint32_t length_counts[deflate_max_code_bits + 1] = {};
+	for (uint32_t i = 0; i < count; ++i)
+		++length_counts[lengths[i]];
+
+	length_counts[0] = 0;
+
+	uint32_t next_codes[deflate_max_code_bits + 1];
+	uint32_t code = 0;
+	for (uint32_t bits = 1; bits <= deflate_max_code_bits; ++bits)
+	{
+		code = (code + length_counts[bits - 1]) << 1;
+		next_codes[bits] = code;
+	}
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const uint32_t length = lengths[i];
+		if (!length)
+			continue;
+
+		const uint32_t canonical = next_codes[length]++;
+
+		uint32_t reversed = 0;
+		for (uint32_t bit = 0; bit < length; ++bit)
+			reversed |= ((canonical >> bit) & 1) << (length - 1 - bit);
+
+		codes[i] = (uint16_t)reversed;
+	}
+}
+
+static void deflate_write_stored(deflate_context* ctx, uint32_t block_end, bool final)
+{
+	uint32_t offset = ctx->block_start;
+
+	do
+	{
+		const uint32_t remaining = block_end - offset;
+		const uint32_t size = remaining < deflate_max_stored ? remaining : deflate_max_stored;
+		const bool last = final && size == remaining;
+
+		deflate_put_bits(ctx, last, 1);
+		deflate_put_bits(ctx, 0, 2);
+		deflate_flush_bits(ctx);
+
+		deflate_put_bits(ctx, size, 16);
+		deflate_put_bits(ctx, ~size & 0xFFFF, 16);
+		print_bytes(ctx->out, (const char*)ctx->data + offset, size);
+
+		offset += size;
+	} while (offset < block_end);
+}
+
+static void deflate_write_block(deflate_context* ctx, uint32_t block_end, bool final)
+{
+	ctx->litlen_freqs[deflate_end_of_block] = 1;
+
+	uint8_t litlen_lengths[deflate_litlen_count];
+	uint8_t dist_lengths[deflate_dist_count];
+	deflate_build_lengths(ctx->litlen_freqs, deflate_litlen_count, deflate_max_code_bits, litlen_lengths);
+	deflate_build_lengths(ctx->dist_freqs, deflate_dist_count, deflate_max_code_bits, dist_lengths);
+
+	// Distance codes must still be described when there are no matches
+	if (dist_lengths[0] == 0 && dist_lengths[1] == 0)
+	{
+		bool has_dist = false;
+		for (uint32_t i = 2; i < deflate_dist_count; ++i)
+			has_dist |= dist_lengths[i] != 0;
+
+		if (!has_dist)
+		{
+			dist_lengths[0] = 1;
+			dist_lengths[1] = 1;
+		}
+	}
+
+	uint32_t dist_count = deflate_dist_count;
+	while (dist_count > 1 && dist_lengths[dist_count - 1] == 0)
+		--dist_count;
+
+	uint32_t litlen_count = deflate_litlen_count;
+	while (litlen_count > 257 && litlen_lengths[litlen_count - 1] == 0)
+		--litlen_count;
+
+	// Code lengths are themselves run-length encoded with codes 16 to 18
+	uint8_t all_lengths[deflate_litlen_count + deflate_dist_count];
+	memcpy(all_lengths, litlen_lengths, litlen_count);
+	memcpy(all_lengths + litlen_count, dist_lengths, dist_count);
+
+	const uint32_t length_count = litlen_count + dist_count;
+	uint8_t rle_symbols[deflate_litlen_count + deflate_dist_count];
+	uint8_t rle_extra[deflate_litlen_count + deflate_dist_count];
+	uint32_t rle_count = 0;
+	uint32_t codelen_freqs[deflate_codelen_count] = {};
+
+	for (uint32_t i = 0; i < length_count;)
+	{
+		const uint8_t length = all_lengths[i];
+
+		uint32_t run = 1;
+		while (i + run < length_count && all_lengths[i + run] == length)
+			++run;
+
+		i += run;
+
+		if (length == 0)
+		{
+			while (run >= 11)
+			{
+				const uint32_t repeat = run < 138 ? run : 138;
+				rle_symbols[rle_count] = 18;
+				rle_extra[rle_count++] = (uint8_t)(repeat - 11);
+				run -= repeat;
+			}
+
+			if (run >= 3)
+			{
+				rle_symbols[rle_count] = 17;
+				rle_extra[rle_count++] = (uint8_t)(run - 3);
+				run = 0;
+			}
+		}
+		else
+		{
+			rle_symbols[rle_count] = length;
+			rle_extra[rle_count++] = 0;
+			--run;
+
+			while (run >= 3)
+			{
+				const uint32_t repeat = run < 6 ? run : 6;
+				rle_symbols[rle_count] = 16;
+				rle_extra[rle_count++] = (uint8_t)(repeat - 3);
+				run -= repeat;
+			}
+		}
+
+		while (run > 0)
+		{
+			rle_symbols[rle_count] = length;
+			rle_extra[rle_count++] = 0;
+			--run;
+		}
+	}
+
+	for (uint32_t i = 0; i < rle_count; ++i)
+		++codelen_freqs[rle_symbols[i]];
+
+	uint8_t codelen_lengths[deflate_codelen_count];
+	deflate_build_lengths(codelen_freqs, deflate_codelen_count, deflate_max_codelen_bits, codelen_lengths);
+
+	uint32_t codelen_count = deflate_codelen_count;
+	while (codelen_count > 4 && codelen_lengths[deflate_codelen_order[codelen_count - 1]] == 0)
+		--codelen_count;
+
+	// Compare the size of the compressed block with storing the bytes as they are
+	static const uint8_t rle_extra_bits[deflate_codelen_count] = { [16] = 2, [17] = 3, [18] = 7 };
+
+	uint64_t dynamic_bits = 3 + 5 + 5 + 4 + 3 * codelen_count;
+	for (uint32_t i = 0; i < rle_count; ++i)
+		dynamic_bits += codelen_lengths[rle_symbols[i]] + rle_extra_bits[rle_symbols[i]];
+	for (uint32_t i = 0; i < deflate_litlen_count; ++i)
+		dynamic_bits += (uint64_t)ctx->litlen_freqs[i] * (litlen_lengths[i] + (i > deflate_end_of_block ? deflate_length_extra[i - 257] : 0));
+	for (uint32_t i = 0; i < deflate_dist_count; ++i)
+		dynamic_bits += (uint64_t)ctx->dist_freqs[i] * (dist_lengths[i] + deflate_dist_extra[i]);
+
+	const uint32_t block_size = block_end - ctx->block_start;
+	const uint64_t stored_bits = ((uint64_t)block_size + 5 * (block_size / deflate_max_stored + 1)) * 8 + 7;
+
+	if (stored_bits <= dynamic_bits)
+	{
+		deflate_write_stored(ctx, block_end, final);
+	}
+	else
+	{
+		uint16_t litlen_codes[deflate_litlen_count];
+		uint16_t dist_codes[deflate_dist_count];
+		uint16_t codelen_codes[deflate_codelen_count];
+		deflate_build_codes(litlen_lengths, deflate_litlen_count, litlen_codes);
+		deflate_build_codes(dist_lengths, deflate_dist_count, dist_codes);
+		deflate_build_codes(codelen_lengths, deflate_codelen_count, codelen_codes);
+
+		deflate_put_bits(ctx, final, 1);
+		deflate_put_bits(ctx, 2, 2);	// Dynamic Huffman codes
+		deflate_put_bits(ctx, litlen_count - 257, 5);
+		deflate_put_bits(ctx, dist_count - 1, 5);
+		deflate_put_bits(ctx, codelen_count - 4, 4);
+
+		for (uint32_t i = 0; i < codelen_count; ++i)
+			deflate_put_bits(ctx, codelen_lengths[deflate_codelen_order[i]], 3);
+
+		for (uint32_t i = 0; i < rle_count; ++i)
+		{
+			const uint8_t symbol = rle_symbols[i];
+			deflate_put_bits(ctx, codelen_codes[symbol], codelen_lengths[symbol]);
+			deflate_put_bits(ctx, rle_extra[i], rle_extra_bits[symbol]);
+		}
+
+		for (uint32_t i = 0; i < ctx->symbol_count; ++i)
+		{
+			const uint32_t dist = ctx->dists[i];
+			const uint32_t length = ctx->lengths[i];
+
+			if (dist == 0)
+			{
+				deflate_put_bits(ctx, litlen_codes[length], litlen_lengths[length]);
+				continue;
+			}
+
+			const uint32_t length_code = ctx->length_code_lookup[length];
+			deflate_put_bits(ctx, litlen_codes[257 + length_code], litlen_lengths[257 + length_code]);
+			deflate_put_bits(ctx, length - deflate_length_base[length_code], deflate_length_extra[length_code]);
+
+			const uint32_t dist_code = deflate_get_dist_code(ctx, dist);
+			deflate_put_bits(ctx, dist_codes[dist_code], dist_lengths[dist_code]);
+			deflate_put_bits(ctx, dist - deflate_dist_base[dist_code], deflate_dist_extra[dist_code]);
+		}
+
+		deflate_put_bits(ctx, litlen_codes[deflate_end_of_block], litlen_lengths[deflate_end_of_block]);
+	}
+
+	memset(ctx->litlen_freqs, 0, sizeof(ctx->litlen_freqs));
+	memset(ctx->dist_freqs, 0, sizeof(ctx->dist_freqs));
+	ctx->symbol_count = 0;
+	ctx->block_start = block_end;
+}
+
+static void deflate_add_literal(deflate_context* ctx, uint32_t pos)
+{
+	const uint8_t literal = ctx->data[pos];
+
+	ctx->lengths[ctx->symbol_count] = literal;
+	ctx->dists[ctx->symbol_count] = 0;
+	++ctx->litlen_freqs[literal];
+
+	if (++ctx->symbol_count == deflate_block_symbols)
+		deflate_write_block(ctx, pos + 1, false);
+}
+
+static void deflate_add_match(deflate_context* ctx, uint32_t pos, uint32_t length, uint32_t dist)
+{
+	ctx->lengths[ctx->symbol_count] = (uint16_t)length;
+	ctx->dists[ctx->symbol_count] = (uint16_t)dist;
+	++ctx->litlen_freqs[257 + ctx->length_code_lookup[length]];
+	++ctx->dist_freqs[deflate_get_dist_code(ctx, dist)];
+
+	if (++ctx->symbol_count == deflate_block_symbols)
+		deflate_write_block(ctx, pos + length, false);
+}
+
+static uint32_t deflate_hash(const uint8_t* data)
+{
+	const uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+	return (value * 2654435761u) >> (32 - deflate_hash_bits);
+}
+
+static void deflate_insert(deflate_context* ctx, uint32_t pos)
+{
+	if (pos + deflate_min_match > ctx->size)
+		return;
+
+	const uint32_t hash = deflate_hash(ctx->data + pos);
+	ctx->prev[pos & deflate_window_mask] = ctx->head[hash];
+	ctx->head[hash] = (int32_t)pos;
+}
+
+/*
+	Returns the length of the longest match at pos that is longer than min_length, or zero if there
+	isn't one. Must be called before pos is inserted into the hash chains.
+*/
+static uint32_t deflate_find_match(deflate_context* ctx, const deflate_level* level, uint32_t pos, uint32_t min_length, uint32_t* out_dist)
+{
+	const uint32_t available = ctx->size - pos;
+	if (available < deflate_min_match)
+		return 0;
+
+	const uint32_t max_length = available < deflate_max_match ? available : deflate_max_match;
+	uint32_t best_length = min_length < deflate_min_match - 1 ? deflate_min_match - 1 : min_length;
+	if (best_length >= max_length)
+		return 0;
+
+	const uint8_t* current = ctx->data + pos;
+	const int64_t limit = (int64_t)pos - deflate_window_size;
+
+	uint32_t best_dist = 0;
+	uint32_t chain = level->max_chain;
+
+	for (int32_t candidate = ctx->head[deflate_hash(current)]; candidate >= 0 && candidate > limit && chain > 0; --chain)
+	{
+		const uint8_t* match = ctx->data + candidate;
+
+		// Check the byte that would make this match the longest so far before comparing the rest
+		if (match[best_length] == current[best_length] && match[0] == current[0] && match[1] == current[1])
+		{
+			uint32_t length = 2;
+			while (length < max_length && match[length] == current[length])
+				++length;
+
+			if (length > best_length)
+			{
+				best_length = length;
+				best_dist = pos - candidate;
+
+				if (length >= level->nice_length || length == max_length)
+					break;
+			}
+		}
+
+		candidate = ctx->prev[candidate & deflate_window_mask];
+	}
+
+	// Short matches far away cost more than the literals they replace
+	if (best_dist == 0 || (best_length == deflate_min_match && best_dist > 4096))
+		return 0;
+
+	*out_dist = best_dist;
+	return best_length;
+}
+
+/*
+	Compresses data from start to size as a raw DEFLATE stream appended to out, using hash chains to
+	find matches and dynamic Huffman codes for each block. Blocks that wouldn't shrink are stored.
+	Bytes before start were compressed by an earlier call and are only used for matches, so a long
+	stream can be compressed in pieces. Pieces that aren't final end on a byte boundary.
+*/
+static void deflate_compress(output_buffer* out, const uint8_t* data, uint32_t start, uint32_t size, int level_index, bool final)
+{
+	assert(level_index > 0 && level_index <= 9);
+	const deflate_level* level = &deflate_levels[level_index];
+
+	// Compression runs on worker threads, so the context comes from the thread's own scratch arena
+	arena* scratch = get_scratch_arena();
+	const arena_mark mark = arena_get_mark(scratch);
+
+	deflate_context* ctx = arena_alloc(scratch, sizeof(deflate_context));
+	ctx->out = out;
+	ctx->data = data;
+	ctx->size = size;
+	ctx->bits = 0;
+	ctx->bit_count = 0;
+	ctx->symbol_count = 0;
+	ctx->block_start = start;
+
+	memset(ctx->litlen_freqs, 0, sizeof(ctx->litlen_freqs));
+	memset(ctx->dist_freqs, 0, sizeof(ctx->dist_freqs));
+	memset(ctx->head, 0xFF, sizeof(ctx->head));
+
+	// Length 258 has its own code rather than being the top of the previous range
+	for (uint32_t code = 0; code < 28; ++code)
+	{
+		for (uint32_t i = 0; i < (1u << deflate_length_extra[code]); ++i)
+			ctx->length_code_lookup[deflate_length_base[code] + i] = (uint8_t)code;
+	}
+	ctx->length_code_lookup[deflate_max_match] = 28;
+
+	// Distances above 256 are looked up in units of 128, which is the size of the smallest range there
+	for (uint32_t code = 0; code < deflate_dist_count; ++code)
+	{
+		if (code < 16)
+		{
+			for (uint32_t i = 0; i < (1u << deflate_dist_extra[code]); ++i)
+				ctx->dist_code_lookup[deflate_dist_base[code] - 1 + i] = (uint8_t)code;
+		}
+		else
+		{
+			for (uint32_t i = 0; i < (1u << (deflate_dist_extra[code] - 7)); ++i)
+				ctx->dist_code_lookup[256 + ((deflate_dist_base[code] - 1) >> 7) + i] = (uint8_t)code;
+		}
+	}
+
+	assert(start <= deflate_window_size);
+	for (uint32_t i = 0; i < start; ++i)
+		deflate_insert(ctx, i);
+
+	uint32_t pos = start;
+	while (pos < size)
+	{
+		uint32_t dist = 0;
+		uint32_t length = deflate_find_match(ctx, level, pos, 0, &dist);
+		deflate_insert(ctx, pos);
+
+		// Lazy matching: prefer a literal here if the next position starts a longer match
+		if (length && length < level->max_lazy)
+		{
+			while (pos + 1 < size)
+			{
+				uint32_t next_dist;
+				const uint32_t next_length = deflate_find_match(ctx, level, pos + 1, length, &next_dist);
+				if (!next_length)
+					break;
+
+				deflate_add_literal(ctx, pos);
+				deflate_insert(ctx, ++pos);
+
+				length = next_length;
+				dist = next_dist;
+
+				if (length >= level->max_lazy)
+					break;
+			}
+		}
+
+		if (length)
+		{
+			deflate_add_match(ctx, pos, length, dist);
+
+			for (uint32_t i = 1; i < length; ++i)
+				deflate_insert(ctx, pos + i);
+
+			pos += length;
+		}
+		else
+		{
+			deflate_add_literal(ctx, pos);
+			++pos;
+		}
+	}
+
+	deflate_write_block(ctx, size, final);
+
+	// An empty stored block pads to the next byte, so the next piece can be appended to out
+	if (!final)
+		deflate_write_stored(ctx, size, false);
+
+	deflate_flush_bits(ctx);
+
+	arena_restore(scratch, mark);
+}
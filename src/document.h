@@ -1,3 +1,4 @@
+// Types that carry text come first, so they can be told apart with a single comparison
 typedef enum
 {
 	document_element_type_heading_1,
@@ -5,15 +6,15 @@ typedef enum
 	document_element_type_heading_3,
 	document_element_type_list_item,
 	document_element_type_text_block,
-	document_element_type_line_break,
 	document_element_type_preformatted,
+	document_element_type_blockquote_citation,
+	document_element_type_line_break,
 	document_element_type_paragraph_end,
 	document_element_type_blockquote_end,
 	document_element_type_paragraph_begin,
 	document_element_type_blockquote_begin,
 	document_element_type_ordered_list_end,
 	document_element_type_unordered_list_end,
-	document_element_type_blockquote_citation,
 	document_element_type_unordered_list_begin,
 	document_element_type_paragraph_break_begin,
 	document_element_type_ordered_list_begin_roman,
@@ -21,6 +22,13 @@ typedef enum
 	document_element_type_ordered_list_begin_letter
 } document_element_type;
 
+static_assert(document_element_type_ordered_list_begin_letter <= UINT8_MAX);	// Types are stored as bytes
+
+static bool is_text_element(document_element_type type)
+{
+	return type <= document_element_type_blockquote_citation;
+}
+
 typedef enum
 {
 	document_type_none,
@@ -47,22 +55,37 @@ typedef struct
 	uint32_t		translator_count;
 } document_metadata;
 
+/*
+	A span of tokenised text, which is also null terminated. The offsets of its control bytes, the
+	text tokens below 32 and apostrophes, are recorded while tokenising, so emitters copy the plain
+	text between them in bulk instead of scanning for them again. Control offsets are relative to
+	the start of the span.
+*/
 typedef struct
 {
-	document_element_type	type;
-	const char*				text;
-} document_element;
+	uint32_t	offset;
+	uint32_t	length;
+	uint32_t	first_control;
+	uint32_t	control_count;
+} text_span;
 
 typedef struct
 {
-	const char*	text;
+	uint32_t	span;
 } document_reference;
 
+/*
+	Each chapter's elements are a stream of byte-sized types. Elements that carry text also have the
+	index of their text span, stored in a separate array in the same order, so emitters read both
+	arrays front to back. The first element of every chapter is its top-level heading.
+*/
 typedef struct
 {
-	document_element*	elements;
+	const uint8_t*		element_types;
+	const uint32_t*		text_spans;
 	document_reference*	references;
 	uint32_t			element_count;
+	uint32_t			text_count;
 	uint32_t			reference_count;
 } document_chapter;
 
@@ -70,5 +93,8 @@ typedef struct
 {
 	document_metadata	metadata;
 	document_chapter*	chapters;
+	const char*			text;
+	const text_span*	spans;
+	const uint32_t*		controls;
 	uint32_t			chapter_count;
 } document;
\ No newline at end of file
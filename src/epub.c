@@ -1,248 +1,221 @@
-static void create_epub_mimetype(void)
+static void create_epub_mimetype(output_buffer* out, zip_writer* zip)
 {
-	FILE* f = open_file(OUTPUT_DIR "/epub/mimetype", file_mode_write);
-	fputs("application/epub+zip", f);
-	fclose(f);
+	print_string(out, "application/epub+zip");
+	zip_write_output(zip, out, "mimetype", zip_compression_store);
 }
 
-static void create_epub_meta_inf(void)
+static void create_epub_meta_inf(output_buffer* out, zip_writer* zip)
 {
-	FILE* f = open_file(OUTPUT_DIR "/epub/META-INF/container.xml", file_mode_write);
-
-	fputs(
+	print_string(out,
 		"<?xml version=\"1.0\"?>\n"
 		"<container version=\"1.0\" xmlns=\"urn:oasis:names:tc:opendocument:xmlns:container\">\n"
 		"\t<rootfiles>\n"
 		"\t\t<rootfile full-path=\"content.opf\" media-type=\"application/oebps-package+xml\" />\n"
 		"\t</rootfiles>\n"
-		"</container>",
-		f
+		"</container>"
 	);
 
-	fclose(f);
+	zip_write_output(zip, out, "META-INF/container.xml", zip_compression_deflate);
 }
 
-static void create_epub_css(void)
+static void create_epub_css(output_buffer* out, zip_writer* zip)
 {
-	FILE* f = open_file(OUTPUT_DIR "/epub/style.css", file_mode_write);
-
 	// Chapter headings are centred
-	fputs(
+	print_string(out,
 		"h1 {\n\t"
 			"text-align: center;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs which don't follow a heading are not indented
-	fputs(
+	print_string(out,
 		"p {\n\t"
 			"margin-top: 0;\n\t"
 			"text-indent: 1.5em;\n\t"
 			"hyphens: auto;\n\t"
 			"margin-bottom: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraph with previous gap
-	fputs(
+	print_string(out,
 		".paragraph-break {\n\t"
 			"margin-top: 1em;\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Footnote
-	fputs(
+	print_string(out,
 		".footnote {\n\t"
 			"margin-top: 1em;\n\t"
 			"text-indent: 0;\n\t"
 			"font-size: 0.75em;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs after headings are not indented
-	fputs(
+	print_string(out,
 		"h1 + p,\n"
 		"h2 + p,\n"
 		"h3 + p {\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Blockquote indentation
-	fputs(
+	print_string(out,
 		"blockquote {\n\t"
 			"margin-left: 1.5em;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// First paragraphs within a blockquote are not indented
-	fputs(
+	print_string(out,
 		"blockquote p {\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs following first blockquote paragraph are indented
-	fputs(
+	print_string(out,
 		"blockquote p + p {\n\t"
 			"text-indent: 1.5em;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs following blockquotes are not indented
-	fputs(
+	print_string(out,
 		"blockquote + p {\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs following lists are not be indented
-	fputs(
+	print_string(out,
 		"ol + p,\n"
 		"ul + p {\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Chapter list should be left-aligned
-	fputs(
+	print_string(out,
 		"ul.chapters {\n\t"
 			"text-align: left;\n"
-		"}",
-		f
+		"}"
 	);
 
-	fclose(f);
+	zip_write_output(zip, out, "style.css", zip_compression_deflate);
 }
 
-static void create_epub_opf(const document* doc)
+static void create_epub_opf(output_buffer* out, zip_writer* zip, const document* doc)
 {
-	FILE* f = open_file(OUTPUT_DIR "/epub/content.opf", file_mode_write);
-
-	fputs(
+	print_string(out,
 		"<?xml version=\"1.0\"?>\n"
 		"<package version=\"2.0\" xmlns=\"http://www.idpf.org/2007/opf\" unique-identifier=\"bookid\">\n"
-		"\t<metadata xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:opf=\"http://www.idpf.org/2007/opf\">\n",
-		f
+		"\t<metadata xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:opf=\"http://www.idpf.org/2007/opf\">\n"
 	);
 
-	fprintf(f, "\t\t<dc:title>%s</dc:title>\n", doc->metadata.title);
-	fprintf(f, "\t\t<dc:language>en-GB</dc:language>\n");
-	fprintf(f, "\t\t<dc:identifier id=\"bookid\" opf:scheme=\"uuid\">6519aff0-f47c-437c-ba20-cc0782b39b05</dc:identifier>\n");
+	print_format(out, "\t\t<dc:title>%s</dc:title>\n", doc->metadata.title);
+	print_string(out, "\t\t<dc:language>en-GB</dc:language>\n");
+	print_string(out, "\t\t<dc:identifier id=\"bookid\" opf:scheme=\"uuid\">6519aff0-f47c-437c-ba20-cc0782b39b05</dc:identifier>\n");
 
 	for (uint32_t i = 0; i < doc->metadata.author_count; ++i)
-		fprintf(f, "\t\t<dc:creator>%s</dc:creator>\n", doc->metadata.authors[i]);
+		print_format(out, "\t\t<dc:creator>%s</dc:creator>\n", doc->metadata.authors[i]);
 
 	// TODO: Figure out how to add translator metadata
 //	for (uint32_t i = 0; i < doc->metadata.translator_count; ++i)
-//		fprintf(f, "\t\t<dc:creator opf:role=\"translator\">%s</dc:creator>\n", doc->metadata.translators[i]);
+//		print_format(out, "\t\t<dc:creator opf:role=\"translator\">%s</dc:creator>\n", doc->metadata.translators[i]);
 
 	// TODO: Add metadata to specify cover image
-	//fputs("\t\t<meta name=\"cover\" content=\"cover_image\"/>\n", f);
+	//print_string(out, "\t\t<meta name=\"cover\" content=\"cover_image\"/>\n");
 
-	fputs("\t</metadata>\n", f);
-	fputs("\t<manifest>\n", f);
-	fputs("\t\t<item id=\"ncx\" href=\"toc.ncx\" media-type=\"application/x-dtbncx+xml\"/>\n", f);
-	fputs("\t\t<item id=\"css\" href=\"style.css\" media-type=\"text/css\"/>\n", f);
+	print_string(out, "\t</metadata>\n");
+	print_string(out, "\t<manifest>\n");
+	print_string(out, "\t\t<item id=\"ncx\" href=\"toc.ncx\" media-type=\"application/x-dtbncx+xml\"/>\n");
+	print_string(out, "\t\t<item id=\"css\" href=\"style.css\" media-type=\"text/css\"/>\n");
 
-//	fprintf(f, "\t\t<item id=\"cover\" href=\"cover.xhtml\" media-type=\"application/xhtml+xml\"/>\n");
-//	fprintf(f, "\t\t<item id=\"cover_image\" href=\"cover.png\" media-type=\"image/png\"/>\n");
+//	print_string(out, "\t\t<item id=\"cover\" href=\"cover.xhtml\" media-type=\"application/xhtml+xml\"/>\n");
+//	print_string(out, "\t\t<item id=\"cover_image\" href=\"cover.png\" media-type=\"image/png\"/>\n");
 
 	if (doc->chapter_count > 1)
-		fprintf(f, "\t\t<item id=\"toc\" href=\"toc.xhtml\" media-type=\"application/xhtml+xml\"/>\n");
+		print_string(out, "\t\t<item id=\"toc\" href=\"toc.xhtml\" media-type=\"application/xhtml+xml\"/>\n");
 
 	for (uint32_t i = 0; i < doc->chapter_count; ++i)
-		fprintf(f, "\t\t<item id=\"chapter%d\" href=\"chapter%d.xhtml\" media-type=\"application/xhtml+xml\"/>\n", i + 1, i + 1);
-	fputs("\t</manifest>\n", f);
+		print_format(out, "\t\t<item id=\"chapter%d\" href=\"chapter%d.xhtml\" media-type=\"application/xhtml+xml\"/>\n", i + 1, i + 1);
+	print_string(out, "\t</manifest>\n");
 
-	fputs("\t<spine toc=\"ncx\">\n", f);
+	print_string(out, "\t<spine toc=\"ncx\">\n");
 
-	//fputs("\t\t<itemref idref=\"cover\"/>\n", f);
+	//print_string(out, "\t\t<itemref idref=\"cover\"/>\n");
 
 	if (doc->chapter_count > 1)
-		fputs("\t\t<itemref idref=\"toc\"/>\n", f);
+		print_string(out, "\t\t<itemref idref=\"toc\"/>\n");
 
 	for (uint32_t i = 0; i < doc->chapter_count; ++i)
-		fprintf(f, "\t\t<itemref idref=\"chapter%d\"/>\n", i + 1);
+		print_format(out, "\t\t<itemref idref=\"chapter%d\"/>\n", i + 1);
 
-	fputs("\t</spine>\n", f);
+	print_string(out, "\t</spine>\n");
 
-	fputs("</package>", f);
+	print_string(out, "</package>");
 
-	fclose(f);
+	zip_write_output(zip, out, "content.opf", zip_compression_deflate);
 }
 
-static void create_epub_ncx(const document* doc)
+static void create_epub_ncx(output_buffer* out, zip_writer* zip, const document* doc)
 {
-	FILE* f = open_file(OUTPUT_DIR "/epub/toc.ncx", file_mode_write);
-
-	fputs(
+	print_string(out,
 		"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
 		"<ncx xmlns=\"http://www.daisy.org/z3986/2005/ncx/\" version=\"2005-1\">\n"
 		"\t<head>\n"
 		"\t\t<meta name=\"dtb:uid\" content=\"6519aff0-f47c-437c-ba20-cc0782b39b05\"/>\n"
-		"\t</head>\n",
-		f
+		"\t</head>\n"
 	);
 
-	fputs("\t<docTitle>", f);
-	fprintf(f, "\t\t<text>%s</text>\n", doc->metadata.title);
-	fputs("\t</docTitle>", f);
+	print_string(out, "\t<docTitle>");
+	print_format(out, "\t\t<text>%s</text>\n", doc->metadata.title);
+	print_string(out, "\t</docTitle>");
 
-	fputs("\t<navMap>\n", f);
+	print_string(out, "\t<navMap>\n");
 
 	for (uint32_t i = 0; i < doc->chapter_count; ++i)
 	{
-		document_element* heading = doc->chapters[i].elements;
-
-		fprintf(f, "\t\t<navPoint class=\"chapter\" id=\"chapter%d\" playOrder=\"%d\">\n", i + 1, i + 1);
-		fputs("\t\t\t<navLabel>\n", f);
-		fprintf(f, "\t\t\t\t<text>%s</text>\n", heading->text);
-		fputs("\t\t\t</navLabel>\n", f);
-		fprintf(f, "\t\t\t<content src=\"chapter%d.xhtml\"/>\n", i + 1);
-		fputs("\t\t</navPoint>\n", f);
+		print_format(out, "\t\t<navPoint class=\"chapter\" id=\"chapter%d\" playOrder=\"%d\">\n", i + 1, i + 1);
+		print_string(out, "\t\t\t<navLabel>\n");
+		print_format(out, "\t\t\t\t<text>%s</text>\n", doc->text + get_chapter_title(doc, i)->offset);
+		print_string(out, "\t\t\t</navLabel>\n");
+		print_format(out, "\t\t\t<content src=\"chapter%d.xhtml\"/>\n", i + 1);
+		print_string(out, "\t\t</navPoint>\n");
 	}
 
-	fputs("\t</navMap>\n", f);
-	fputs("</ncx>", f);
+	print_string(out, "\t</navMap>\n");
+	print_string(out, "</ncx>");
 
-	fclose(f);
+	zip_write_output(zip, out, "toc.ncx", zip_compression_deflate);
 }
 
-static void create_epub_toc(const document* doc)
+static void create_epub_toc(output_buffer* out, zip_writer* zip, const document* doc)
 {
 	if (doc->chapter_count > 1)
 		return;
 
-	FILE* f = open_file(OUTPUT_DIR "/epub/toc.xhtml", file_mode_write);
-
 	html_context ctx = {
-		.f		= f,
+		.out	= out,
 		.doc	= doc
 	};
 
-	fprintf(f,
+	print_string(out,
 		"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
 		"<html xmlns=\"http://www.w3.org/1999/xhtml\">\n"
 		"\t<head>\n"
@@ -257,36 +230,36 @@ static void create_epub_toc(const document* doc)
 
 	for (uint32_t chapter_index = 0; chapter_index < doc->chapter_count; ++chapter_index)
 	{
-		document_element* heading = doc->chapters[chapter_index].elements;
-
-		fprintf(f, "\t\t\t\t<li><a href=\"chapter%d.xhtml\">", chapter_index + 1);
-		print_simple_text(ctx.f, heading->text);
-		fprintf(f, "</a></li>\n");
+		print_format(out, "\t\t\t\t<li><a href=\"chapter%d.xhtml\">", chapter_index + 1);
+		print_simple_text(ctx.out, doc, get_chapter_title(doc, chapter_index));
+		print_string(out, "</a></li>\n");
 	}
 
-	fprintf(f,
+	print_string(out,
 		"\n\t\t</ul>\n"
 		"\n\t</body>\n"
 		"</html>"
 	);
 
-	fclose(f);
+	zip_write_output(zip, out, "toc.xhtml", zip_compression_deflate);
 }
 
-static void create_epub_chapter(const document* doc, uint32_t index)
+static void create_epub_chapter(output_buffer* out, zip_writer* zip, const document* doc, uint32_t index)
 {
-	const char* filepath = generate_path(OUTPUT_DIR "/epub/chapter%d.xhtml", index + 1);
-	FILE* f = open_file(filepath, file_mode_write);
+	const uint64_t trace_start = trace_begin();
+
+	char filename[32];
+	snprintf(filename, sizeof(filename), "chapter%u.xhtml", index + 1);
 
 	html_context ctx = {
-		.f				= f,
+		.out			= out,
 		.doc			= doc,
 		.chapter_index	= index
 	};
 
 	document_chapter* chapter = &doc->chapters[index];
 
-	fprintf(f,
+	print_format(out,
 		"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
 		"<html xmlns=\"http://www.w3.org/1999/xhtml\">\n"
 		"\t<head>\n"
@@ -294,101 +267,105 @@ static void create_epub_chapter(const document* doc, uint32_t index)
 		"\t\t<link href=\"style.css\" rel=\"stylesheet\">\n"
 		"\t</head>\n"
 		"\t<body>",
-		chapter->elements[0].text
+		doc->text + get_chapter_title(doc, index)->offset
 	);
 
 	int depth = 2;
 
+	// Only elements that carry text have a span, so they are read in order
+	const uint32_t* span_index = chapter->text_spans;
+
 	for (uint32_t element_index = 0; element_index < chapter->element_count; ++element_index)
 	{
-		document_element* element = &chapter->elements[element_index];
+		const document_element_type type = chapter->element_types[element_index];
+		const text_span* span = is_text_element(type) ? &doc->spans[*span_index++] : nullptr;
 
-		switch (element->type)
+		switch (type)
 		{
 		case document_element_type_heading_1:
 			ctx.chapter_ref_count = 0;
 			ctx.inline_chapter_ref_count = 0;
 
-			print_tabs(f, depth);
-			fputs("<h1>", f);
-			print_html_text_block(&ctx, element->text);
-			fprintf(f, "</h1>");
+			print_tabs(out, depth);
+			print_string(out, "<h1>");
+			print_html_text_block(&ctx, span);
+			print_string(out, "</h1>");
 			break;
 		case document_element_type_heading_2:
-			print_tabs(f, depth);
-			fputs("<h2>", f);
-			print_html_text_block(&ctx, element->text);
-			fprintf(f, "</h2>");
+			print_tabs(out, depth);
+			print_string(out, "<h2>");
+			print_html_text_block(&ctx, span);
+			print_string(out, "</h2>");
 			break;
 		case document_element_type_heading_3:
-			print_tabs(f, depth);
-			fputs("<h3>", f);
-			print_html_text_block(&ctx, element->text);
-			fprintf(f, "</h3>");
+			print_tabs(out, depth);
+			print_string(out, "<h3>");
+			print_html_text_block(&ctx, span);
+			print_string(out, "</h3>");
 			break;
 		case document_element_type_text_block:
-			print_tabs(f, depth + 1);
-			print_html_text_block(&ctx, element->text);
+			print_tabs(out, depth + 1);
+			print_html_text_block(&ctx, span);
 			break;
 		case document_element_type_line_break:
-			fputs("<br/>", f);
+			print_string(out, "<br/>");
 			break;
 		case document_element_type_paragraph_begin:
-			print_tabs(f, depth);
-			fputs("<p>", f);
+			print_tabs(out, depth);
+			print_string(out, "<p>");
 			break;
 		case document_element_type_paragraph_break_begin:
-			print_tabs(f, depth);
-			fputs("<p class=\"paragraph-break\">", f);
+			print_tabs(out, depth);
+			print_string(out, "<p class=\"paragraph-break\">");
 			break;
 		case document_element_type_paragraph_end:
-			print_tabs(f, depth);
-			fputs("</p>", f);
+			print_tabs(out, depth);
+			print_string(out, "</p>");
 			break;
 		case document_element_type_blockquote_begin:
-			print_tabs(f, depth++);
-			fputs("<blockquote>", f);
+			print_tabs(out, depth++);
+			print_string(out, "<blockquote>");
 			break;
 		case document_element_type_blockquote_end:
-			print_tabs(f, --depth);
-			fputs("</blockquote>", f);
+			print_tabs(out, --depth);
+			print_string(out, "</blockquote>");
 			break;
 		case document_element_type_blockquote_citation:
-			print_tabs(f, depth);
-			fputs("<p class=\"paragraph-break\">", f);
-			print_em_dash(f);
-			print_html_text_block(&ctx, element->text);
-			fputs("</p>", f);
+			print_tabs(out, depth);
+			print_string(out, "<p class=\"paragraph-break\">");
+			print_em_dash(out);
+			print_html_text_block(&ctx, span);
+			print_string(out, "</p>");
 			break;
 		case document_element_type_ordered_list_begin_roman:
-			print_tabs(f, depth++);
-			fputs("<ol type=\"I\">", f);
+			print_tabs(out, depth++);
+			print_string(out, "<ol type=\"I\">");
 			break;
 		case document_element_type_ordered_list_begin_arabic:
-			print_tabs(f, depth++);
-			fputs("<ol>", f);
+			print_tabs(out, depth++);
+			print_string(out, "<ol>");
 			break;
 		case document_element_type_ordered_list_begin_letter:
-			print_tabs(f, depth++);
-			fputs("<ol type=\"a\">", f);
+			print_tabs(out, depth++);
+			print_string(out, "<ol type=\"a\">");
 			break;
 		case document_element_type_ordered_list_end:
-			print_tabs(f, --depth);
-			fputs("</ol>", f);
+			print_tabs(out, --depth);
+			print_string(out, "</ol>");
 			break;
 		case document_element_type_unordered_list_begin:
-			print_tabs(f, depth++);
-			fputs("<ul>", f);
+			print_tabs(out, depth++);
+			print_string(out, "<ul>");
 			break;
 		case document_element_type_unordered_list_end:
-			print_tabs(f, --depth);
-			fputs("</ul>", f);
+			print_tabs(out, --depth);
+			print_string(out, "</ul>");
 			break;
 		case document_element_type_list_item:
-			print_tabs(f, depth);
-			fputs("<li>", f);
-			print_html_text_block(&ctx, element->text);
-			fprintf(f, "</li>");
+			print_tabs(out, depth);
+			print_string(out, "<li>");
+			print_html_text_block(&ctx, span);
+			print_string(out, "</li>");
 			break;
 		}
 	}
@@ -401,34 +378,52 @@ static void create_epub_chapter(const document* doc, uint32_t index)
 			++ctx.chapter_ref_count;
 
 			document_reference* reference = &chapter->references[reference_index];
-			fprintf(f, "\n\t\t<p class=\"footnote\" id=\"ref%d\">\n", ctx.ref_count);
-			fprintf(f, "\t\t\t[<a href=\"#ref-return%d\">%d</a>] ", ctx.ref_count, ctx.chapter_ref_count);
-			print_html_text_block(&ctx, reference->text);
-			fprintf(f, "\n\t\t</p>");
+			print_format(out, "\n\t\t<p class=\"footnote\" id=\"ref%d\">\n", ctx.ref_count);
+			print_format(out, "\t\t\t[<a href=\"#ref-return%d\">%d</a>] ", ctx.ref_count, ctx.chapter_ref_count);
+			print_html_text_block(&ctx, &doc->spans[reference->span]);
+			print_string(out, "\n\t\t</p>");
 		}
 	}
 
-	fputs(
+	print_string(out,
 		"\n\t</body>\n"
-		"</html>",
-		f
+		"</html>"
 	);
 
-	fclose(f);
+	trace_end("create_epub_chapter", filename, trace_start, out->size);
+
+	zip_write_output(zip, out, filename, zip_compression_deflate);
 }
 
-static void generate_epub(const document* doc)
+static void generate_epub(const document* doc, const char* dir, int level)
 {
-	delete_dir(OUTPUT_DIR "\\epub");
-	create_dir(OUTPUT_DIR "\\epub\\META-INF");
+	// File names and zip entries are released together once the archive is written
+	arena* scratch = get_scratch_arena();
+	const arena_mark mark = arena_get_mark(scratch);
+
+	const char* filename = generate_url_filename(scratch, doc->metadata.title, "epub");
 
-	create_epub_mimetype();
-	create_epub_meta_inf();
-	create_epub_css();
-	create_epub_opf(doc);
-	create_epub_ncx(doc);
-	create_epub_toc(doc);
+	const char* filepath = arena_format(scratch, "%s/%s", dir, filename);
+
+	zip_writer zip;
+	zip_begin(&zip, scratch, filepath, level);
+
+	output_buffer buffer = {};
+	output_buffer* out = &buffer;
+	push_error_cleanup(free_output_buffer, out);
+
+	create_epub_mimetype(out, &zip);
+	create_epub_meta_inf(out, &zip);
+	create_epub_css(out, &zip);
+	create_epub_opf(out, &zip, doc);
+	create_epub_ncx(out, &zip, doc);
+	create_epub_toc(out, &zip, doc);
 
 	for (uint32_t i = 0; i < doc->chapter_count; ++i)
-		create_epub_chapter(doc, i);
+		create_epub_chapter(out, &zip, doc, i);
+
+	zip_end(&zip);
+	pop_error_cleanup(out);
+	free_output_buffer(out);
+	arena_restore(scratch, mark);
 }
\ No newline at end of file
@@ -1 +0,0 @@
-static void finalise(line_tokens* tokens, const doc_mem_req* mem_req, document* out_doc);
\ No newline at end of file
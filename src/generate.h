@@ -1,6 +1,6 @@
 typedef struct
 {
-	FILE*			f;
+	output_buffer*	out;
 	const document*	doc;
 	int				ref_count;
 	int				chapter_index;
@@ -9,9 +9,70 @@ typedef struct
 	int				inline_chapter_ref_count;
 } html_context;
 
-static void print_html_text_block(html_context* ctx, const char* text);
-static void generate_zip(const char* filepath, const char** input_files, const char** output_files, uint32_t count);
+static void print_html_text_block(html_context* ctx, const text_span* span);
+static const char* generate_url_filename(arena* memory, const char* filepath, const char* ext);
+static const text_span* get_chapter_title(const document* doc, uint32_t chapter_index);
+static void print_simple_text(output_buffer* out, const document* doc, const text_span* span);
+/*
+	Archives are streamed to disk one entry at a time. Stored entries are written as they arrive,
+	with placeholder sizes in the local header that are patched once the entry ends. Compressed
+	entries are held in memory until a batch of them has been compressed in parallel, then written
+	in order with their final headers. An entry that grows too large to hold, such as the ODT
+	content, is instead compressed in pieces as it is written and patched like a stored entry.
+*/
+typedef enum
+{
+	zip_compression_store	= 0x0000,
+	zip_compression_deflate	= 0x0008
+} zip_compression;
+
+typedef struct
+{
+	const char*	filename;
+	uint32_t	crc32;
+	uint32_t	size;
+	uint32_t	compressed_size;
+	uint32_t	local_header_offset;
+	uint16_t	filename_len;
+	uint16_t	compression_type;
+} zip_entry;
+
+typedef struct
+{
+	uint32_t		entry_index;
+	output_buffer	data;
+	output_buffer	compressed;
+	uint32_t		history_size;	// Bytes at the start of data already written, kept for matches
+	bool			streamed;		// Pieces of the entry have been written to the file
+} zip_pending_entry;
+
+typedef struct
+{
+	const char*			filepath;
+	FILE*				f;
+	arena*				memory;
+	zip_entry*			entries;
+	zip_pending_entry*	pending;
+	uint32_t			entry_count;
+	uint32_t			entry_capacity;
+	uint32_t			pending_count;
+	uint32_t			pending_capacity;
+	uint32_t			offset;
+	uint64_t			entry_trace_start;
+	int					level;
+	uint16_t			date;
+	uint16_t			time;
+	bool				in_entry;
+} zip_writer;
+
+static void zip_begin(zip_writer* zip, arena* memory, const char* filepath, int level);
+static void zip_begin_entry(zip_writer* zip, const char* filename, zip_compression compression);
+static void zip_write(zip_writer* zip, const void* data, uint32_t size);
+static void zip_end_entry(zip_writer* zip);
+static void zip_write_buffer(zip_writer* zip, output_buffer* out);
+static void zip_write_output(zip_writer* zip, output_buffer* out, const char* filename, zip_compression compression);
+static void zip_end(zip_writer* zip);
 
-static void generate_odt(const document* doc);
-static void generate_html(const document* doc);
-static void generate_epub(const document* doc);
\ No newline at end of file
+static void generate_odt(const document* doc, const char* dir, int level);
+static void generate_html(const document* doc, const char* dir);
+static void generate_epub(const document* doc, const char* dir, int level);
\ No newline at end of file
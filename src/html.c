@@ -1,24 +1,34 @@
-static void print_html_text_block(html_context* ctx, const char* text)
+static void print_html_text_block(html_context* ctx, const text_span* span)
 {
-	while (*text)
+	const char* text = ctx->doc->text + span->offset;
+	const uint32_t* controls = ctx->doc->controls + span->first_control;
+	uint32_t pos = 0;
+
+	for (uint32_t i = 0; i < span->control_count; ++i)
 	{
-		if (*text == text_token_type_strong_begin)
+		// Copy plain text in bulk up to the next text token or apostrophe
+		const uint32_t control = controls[i];
+		print_bytes(ctx->out, text + pos, control - pos);
+		pos = control + 1;
+
+		const char c = text[control];
+		if (c == text_token_type_strong_begin)
 		{
-			fputs("<strong>", ctx->f);
+			print_string(ctx->out, "<strong>");
 		}
-		else if (*text == text_token_type_strong_end)
+		else if (c == text_token_type_strong_end)
 		{
-			fputs("</strong>", ctx->f);
+			print_string(ctx->out, "</strong>");
 		}
-		else if (*text == text_token_type_emphasis_begin)
+		else if (c == text_token_type_emphasis_begin)
 		{
-			fputs("<em>", ctx->f);
+			print_string(ctx->out, "<em>");
 		}
-		else if (*text == text_token_type_emphasis_end)
+		else if (c == text_token_type_emphasis_end)
 		{
-			fputs("</em>", ctx->f);
+			print_string(ctx->out, "</em>");
 		}
-		else if (*text == text_token_type_reference)
+		else if (c == text_token_type_reference)
 		{
 			const uint32_t ref_count = ctx->inline_ref_count++ + 1;
 			const uint32_t chapter_ref_count = ctx->inline_chapter_ref_count++;
@@ -26,20 +36,45 @@ static void print_html_text_block(html_context* ctx, const char* text)
 			const document_chapter* chapter = &ctx->doc->chapters[ctx->chapter_index];
 			const document_reference* reference = &chapter->references[chapter_ref_count];
 
-			fprintf(ctx->f, "<sup><a id=\"ref-return%d\" href=\"#ref%d\" title=\"", ref_count, ref_count);
-			print_simple_text(ctx->f, reference->text);
-			fprintf(ctx->f, "\">[%d]</a></sup>", chapter_ref_count + 1);
+			print_format(ctx->out, "<sup><a id=\"ref-return%d\" href=\"#ref%d\" title=\"", ref_count, ref_count);
+			print_simple_text(ctx->out, ctx->doc, &ctx->doc->spans[reference->span]);
+			print_format(ctx->out, "\">[%d]</a></sup>", chapter_ref_count + 1);
 		}
 		else
 		{
-			print_char(ctx->f, *text);
+			print_char(ctx->out, c);
 		}
+	}
+
+	print_bytes(ctx->out, text + pos, span->length - pos);
+}
+
+static void print_simple_text(output_buffer* out, const document* doc, const text_span* span)
+{
+	const char* text = doc->text + span->offset;
+	const uint32_t* controls = doc->controls + span->first_control;
+	uint32_t pos = 0;
 
-		++text;
+	for (uint32_t i = 0; i < span->control_count; ++i)
+	{
+		const uint32_t control = controls[i];
+		print_bytes(out, text + pos, control - pos);
+		print_char(out, text[control]);
+		pos = control + 1;
 	}
+
+	print_bytes(out, text + pos, span->length - pos);
 }
 
-static const char* generate_url_path(const char* filepath, const char* ext)
+static const text_span* get_chapter_title(const document* doc, uint32_t chapter_index)
+{
+	const document_chapter* chapter = &doc->chapters[chapter_index];
+	assert(chapter->element_count && chapter->element_types[0] == document_element_type_heading_1);
+
+	return &doc->spans[chapter->text_spans[0]];
+}
+
+static const char* generate_url_filename(arena* memory, const char* filepath, const char* ext)
 {
 	assert(filepath);
 	assert(*filepath);
@@ -50,10 +85,6 @@ static const char* generate_url_path(const char* filepath, const char* ext)
 	char buffer[256];
 	char* current = buffer;
 
-	memcpy(current, output_dir, output_len);
-	current += output_len;
-	*current++ = '/';
-
 	for (;;)
 	{
 		const char c = *filepath++;
@@ -72,6 +103,10 @@ static const char* generate_url_path(const char* filepath, const char* ext)
 			break;
 	}
 
+	// TODO: Add metadata option to override filename
+	if (current == buffer)
+		handle_error("Unable to generate web-safe filename from title.");
+
 	// Add extension
 	*current++ = '.';
 	while (*ext)
@@ -80,32 +115,25 @@ static const char* generate_url_path(const char* filepath, const char* ext)
 	// Null terminate
 	*current++ = 0;
 
-	// TODO: Add metadata option to override filename
-	if (current == buffer)
-		handle_error("Unable to generate web-safe filename from title.");
-
 	const int64_t size = current - buffer;
-	char* url_path = malloc(size);
+	char* url_path = arena_alloc(memory, size);
 	memcpy(url_path, buffer, size);
 
 	return url_path;
 }
 
-static void create_html_css(void)
+static void create_html_css(output_buffer* out, const char* dir)
 {
-	FILE* f = open_file(OUTPUT_DIR "/style.css", file_mode_write);
-
 	// This adds support for light and dark modes based on browser settings
-	fputs(
+	print_string(out,
 		":root {\n\t"
 			"color-scheme: light dark;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Default universal settings
-	fputs(
+	print_string(out,
 		"body {\n\t"
 			// Set font and base size
 			"font-family: \"Georgia\", serif;\n\t"
@@ -121,269 +149,253 @@ static void create_html_css(void)
 			"padding-left: 1em;\n\t"
 			"padding-right: 1em;\n\t"
 			"padding-bottom: 1em;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Chapter headings are centred
-	fputs(
+	print_string(out,
 		"h1 {\n\t"
 			"text-align: center;\n"//\t"
 			//"page-break-before: always;\n" // Ensures chapters start on a new page when printed
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Title heading
-	fputs(
+	print_string(out,
 		"h1.title {\n\t"
 			"font-size: 48px;\n\t"
 			"padding-top: 128px;\n\t"
 			"padding-bottom: 128px;\n\t"
 			"page-break-before: avoid;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Superscript
-	fputs(
+	print_string(out,
 		"sup {\n\t"
 			"line-height: 0;\n\t"	// Prevent references from increasing line height
 			"font-size: 0.75em;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Remove underlines from hyperlinks
-	fputs(
+	print_string(out,
 		"a {\n\t"
 			"text-decoration: none;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Add underline when hovering over link
-	fputs(
+	print_string(out,
 		"a:hover {\n\t"
 			"text-decoration: underline;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Links should not stand out when printing
-	fputs(
+	print_string(out,
 		"@media print {\n\t"
 			"a {\n\t\t"
 				"color: black;\n\t"
 			"}\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Avoid new lines after a heading when printing
-	fputs(
+	print_string(out,
 		"h1, h2, h3 {\n\t"
 			"page-break-after: avoid;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs which don't follow a heading are not indented
-	fputs(
+	print_string(out,
 		"p {\n\t"
 			"margin-top: 0;\n\t"
 			"text-indent: 1.5em;\n\t"
 			"text-align: justify;\n\t"
 			"hyphens: auto;\n\t"
 			"margin-bottom: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraph with previous gap
-	fputs(
+	print_string(out,
 		"p.paragraph-break {\n\t"
 			"margin-top: 1em;\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Authors
-	fputs(
+	print_string(out,
 		"p.authors {\n\t"
 			"text-align: center;\n\t"
 			"padding-top: 0;\n\t"
 			"padding-bottom: 128px;\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Footnote
-	fputs(
+	print_string(out,
 		"p.footnote {\n\t"
 			"margin-top: 1em;\n\t"
 			"text-indent: 0;\n\t"
 			"font-size: 0.75em;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs after headings are not indented
-	fputs(
+	print_string(out,
 		"h1 + p,\n"
 		"h2 + p,\n"
 		"h3 + p {\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Blockquote indentation
-	fputs(
+	print_string(out,
 		"blockquote {\n\t"
 			"margin-left: 1.5em;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// First paragraphs within a blockquote are not indented
-	fputs(
+	print_string(out,
 		"blockquote p {\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs following first blockquote paragraph are indented
-	fputs(
+	print_string(out,
 		"blockquote p + p {\n\t"
 			"text-indent: 1.5em;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs following blockquotes are not indented
-	fputs(
+	print_string(out,
 		"blockquote + p {\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Lists
-	fputs(
+	print_string(out,
 		"ol, ul {\n\t"
 			"text-align: justify;\n\t"
 			"hyphens: auto;\n\t"
 			"margin-left: 1.5em;\n\t"
 			"padding-left: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Paragraphs following lists are not be indented
-	fputs(
+	print_string(out,
 		"ol + p,\n"
 		"ul + p {\n\t"
 			"text-indent: 0;\n"
-		"}",
-		f
+		"}"
 	);
-	fputs("\n\n", f);
+	print_string(out, "\n\n");
 
 	// Chapter list should be left-aligned
-	fputs(
+	print_string(out,
 		"ul.chapters {\n\t"
 			"text-align: left;\n"
-		"}",
-		f
+		"}"
 	);
 
-	fclose(f);
+	write_output(out, dir, "style.css");
 }
 
-static void generate_html(const document* doc)
+static void generate_html(const document* doc, const char* dir)
 {
-	create_html_css();
+	arena* scratch = get_scratch_arena();
+	const arena_mark mark = arena_get_mark(scratch);
+
+	output_buffer buffer = {};
+	output_buffer* out = &buffer;
+	push_error_cleanup(free_output_buffer, out);
 
-	const char* filepath = generate_url_path(doc->metadata.title, "html");
-	FILE* f = open_file(filepath, file_mode_write);
+	create_html_css(out, dir);
+
+	const char* filename = generate_url_filename(scratch, doc->metadata.title, "html");
 
 	html_context ctx = {
-		.f		= f,
+		.out	= out,
 		.doc	= doc
 	};
 
-	fputs(
+	print_string(out,
 		"<!DOCTYPE html>\n"
 		"<html lang=\"en-GB\">\n"
 		"\t<head>\n"
 		"\t\t<meta charset=\"UTF-8\">\n"
 		"\t\t<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">\n"
-		"\t\t<link href=\"style.css\" rel=\"stylesheet\">\n",
-		f
+		"\t\t<link href=\"style.css\" rel=\"stylesheet\">\n"
 	);
 
 	if (doc->metadata.title)
-		fprintf(f, "\t\t<title>%s</title>\n", doc->metadata.title);
+		print_format(out, "\t\t<title>%s</title>\n", doc->metadata.title);
 
-	fputs(
+	print_string(out,
 		"\t</head>\n"
-		"\t<body>",
-		f
+		"\t<body>"
 	);
 
 	if (doc->metadata.type == document_type_book)
 	{
 		if (doc->metadata.title)
-			fprintf(f, "\n\t\t<h1 class=\"title\">%s</h1>", doc->metadata.title);
+			print_format(out, "\n\t\t<h1 class=\"title\">%s</h1>", doc->metadata.title);
 
 		if (doc->metadata.author_count)
 		{
-			fprintf(f, "\n\t\t<p class=\"authors\">");
+			print_string(out, "\n\t\t<p class=\"authors\">");
 
 			for (uint32_t i = 0; i < doc->metadata.author_count - 1; ++i)
-				fprintf(f, "\n\t\t\t%s<br>", doc->metadata.authors[i]);
-			fprintf(f, "\n\t\t\t%s", doc->metadata.authors[doc->metadata.author_count - 1]);
+				print_format(out, "\n\t\t\t%s<br>", doc->metadata.authors[i]);
+			print_format(out, "\n\t\t\t%s", doc->metadata.authors[doc->metadata.author_count - 1]);
 
-			fprintf(f, "\n\t\t</p>");
+			print_string(out, "\n\t\t</p>");
 		}
 
 		if (doc->metadata.translator_count)
 		{
-			fprintf(f, "\n\t\t<p class=\"authors\">");
-			fprintf(f, "\n\t\t\tTranslated by:<br>");
+			print_string(out, "\n\t\t<p class=\"authors\">");
+			print_string(out, "\n\t\t\tTranslated by:<br>");
 
 			for (uint32_t i = 0; i < doc->metadata.translator_count - 1; ++i)
-				fprintf(f, "\n\t\t\t%s<br>", doc->metadata.translators[i]);
-			fprintf(f, "\n\t\t\t%s", doc->metadata.translators[doc->metadata.translator_count - 1]);
+				print_format(out, "\n\t\t\t%s<br>", doc->metadata.translators[i]);
+			print_format(out, "\n\t\t\t%s", doc->metadata.translators[doc->metadata.translator_count - 1]);
 
-			fprintf(f, "\n\t\t</p>");
+			print_string(out, "\n\t\t</p>");
 		}
 
 		if (doc->chapter_count > 1)
 		{
-			fprintf(f,
+			print_string(out,
 				"\n\t\t<h1>Contents</h1>\n"
 				"\t\t<p>\n"
 				"\t\t\t<ul class=\"chapters\">\n"
@@ -391,14 +403,12 @@ static void generate_html(const document* doc)
 
 			for (uint32_t chapter_index = 0; chapter_index < doc->chapter_count; ++chapter_index)
 			{
-				document_element* heading = doc->chapters[chapter_index].elements;
-
-				fprintf(f, "\t\t\t\t<li><a href=\"#h%d\">", chapter_index + 1);
-				print_simple_text(ctx.f, heading->text);
-				fprintf(f, "</a></li>\n");
+				print_format(out, "\t\t\t\t<li><a href=\"#h%d\">", chapter_index + 1);
+				print_simple_text(ctx.out, doc, get_chapter_title(doc, chapter_index));
+				print_string(out, "</a></li>\n");
 			}
 
-			fprintf(f,
+			print_string(out,
 				"\t\t\t</ul>\n"
 				"\t\t</p>"
 			);
@@ -409,100 +419,107 @@ static void generate_html(const document* doc)
 
 	for (uint32_t chapter_index = 0; chapter_index < doc->chapter_count; ++chapter_index)
 	{
+		const uint64_t trace_start = trace_begin();
+		const uint32_t chapter_offset = out->size;
+
 		document_chapter* chapter = &doc->chapters[chapter_index];
 		ctx.chapter_index = chapter_index;
 
+		// Only elements that carry text have a span, so they are read in order
+		const uint32_t* span_index = chapter->text_spans;
+
 		for (uint32_t element_index = 0; element_index < chapter->element_count; ++element_index)
 		{
-			document_element* element = &chapter->elements[element_index];
+			const document_element_type type = chapter->element_types[element_index];
+			const text_span* span = is_text_element(type) ? &doc->spans[*span_index++] : nullptr;
 
-			switch (element->type)
+			switch (type)
 			{
 			case document_element_type_heading_1:
 				ctx.chapter_ref_count = 0;
 				ctx.inline_chapter_ref_count = 0;
 
-				print_tabs(f, depth);
+				print_tabs(out, depth);
 				if (doc->metadata.type == document_type_book)
-					fprintf(f, "<h1 id=\"h%d\">", chapter_index + 1);
+					print_format(out, "<h1 id=\"h%d\">", chapter_index + 1);
 				else
-					fputs("<h1>", f);
-				print_html_text_block(&ctx, element->text);
-				fprintf(f, "</h1>");
+					print_string(out, "<h1>");
+				print_html_text_block(&ctx, span);
+				print_string(out, "</h1>");
 				break;
 			case document_element_type_heading_2:
-				print_tabs(f, depth);
-				fputs("<h2>", f);
-				print_html_text_block(&ctx, element->text);
-				fprintf(f, "</h2>");
+				print_tabs(out, depth);
+				print_string(out, "<h2>");
+				print_html_text_block(&ctx, span);
+				print_string(out, "</h2>");
 				break;
 			case document_element_type_heading_3:
-				print_tabs(f, depth);
-				fputs("<h3>", f);
-				print_html_text_block(&ctx, element->text);
-				fprintf(f, "</h3>");
+				print_tabs(out, depth);
+				print_string(out, "<h3>");
+				print_html_text_block(&ctx, span);
+				print_string(out, "</h3>");
 				break;
 			case document_element_type_text_block:
-				print_html_text_block(&ctx, element->text);
+				print_html_text_block(&ctx, span);
 				break;
 			case document_element_type_line_break:
-				fputs("<br>", f);
+				print_string(out, "<br>");
 				break;
 			case document_element_type_paragraph_begin:
-				print_tabs(f, depth);
-				fputs("<p>", f);
+				print_tabs(out, depth);
+				print_string(out, "<p>");
 				break;
 			case document_element_type_paragraph_break_begin:
-				print_tabs(f, depth);
-				fputs("<p class=\"paragraph-break\">", f);
+				print_tabs(out, depth);
+				print_string(out, "<p class=\"paragraph-break\">");
 				break;
 			case document_element_type_paragraph_end:
-				fputs("</p>", f);
+				print_string(out, "</p>");
 				break;
 			case document_element_type_blockquote_begin:
-				print_tabs(f, depth++);
-				fputs("<blockquote>", f);
+				print_tabs(out, depth++);
+				print_string(out, "<blockquote>");
 				break;
 			case document_element_type_blockquote_end:
-				print_tabs(f, --depth);
-				fputs("</blockquote>", f);
+				print_tabs(out, --depth);
+				print_string(out, "</blockquote>");
 				break;
 			case document_element_type_blockquote_citation:
-				print_tabs(f, depth);
-				fputs("<p class=\"paragraph-break\">", f);
-				print_em_dash(f);
-				print_html_text_block(&ctx, element->text);
-				fputs("</p>", f);
+				print_tabs(out, depth);
+				print_string(out, "<p class=\"paragraph-break\">");
+				print_em_dash(out);
+				print_html_text_block(&ctx, span);
+				print_string(out, "</p>");
 				break;
 			case document_element_type_ordered_list_begin_roman:
-				print_tabs(f, depth++);
-				fputs("<ol type=\"I\">", f);
+				print_tabs(out, depth++);
+				print_string(out, "<ol type=\"I\">");
 				break;
 			case document_element_type_ordered_list_begin_arabic:
-				print_tabs(f, depth++);
-				fputs("<ol>", f);
+				print_tabs(out, depth++);
+				print_string(out, "<ol>");
 				break;
 			case document_element_type_ordered_list_begin_letter:
-				print_tabs(f, depth++);
-				fputs("<ol type=\"a\">", f);
+				print_tabs(out, depth++);
+				print_string(out, "<ol type=\"a\">");
 				break;
 			case document_element_type_ordered_list_end:
-				print_tabs(f, --depth);
-				fputs("</ol>", f);
+				print_tabs(out, --depth);
+				print_string(out, "</ol>");
 				break;
 			case document_element_type_unordered_list_begin:
-				print_tabs(f, depth++);
-				fputs("<ul>", f);
+				print_tabs(out, depth++);
+				print_string(out, "<ul>");
 				break;
 			case document_element_type_unordered_list_end:
-				print_tabs(f, --depth);
-				fputs("</ul>", f);
+				print_tabs(out, --depth);
+				print_string(out, "</ul>");
 				break;
 			case document_element_type_list_item:
-				print_tabs(f, depth);
-				fputs("<li>", f);
-				print_html_text_block(&ctx, element->text);
-				fprintf(f, "</li>");
+				print_tabs(out, depth);
+				print_string(out, "<li>");
+				print_html_text_block(&ctx, span);
+				print_string(out, "</li>");
 				break;
 			}
 		}
@@ -515,19 +532,25 @@ static void generate_html(const document* doc)
 				++ctx.chapter_ref_count;
 
 				document_reference* reference = &chapter->references[reference_index];
-				fprintf(f, "\n\t\t<p class=\"footnote\" id=\"ref%d\">\n", ctx.ref_count);
-				fprintf(f, "\t\t\t[<a href=\"#ref-return%d\">%d</a>] ", ctx.ref_count, ctx.chapter_ref_count);
-				print_html_text_block(&ctx, reference->text);
-				fprintf(f, "\n\t\t</p>");
+				print_format(out, "\n\t\t<p class=\"footnote\" id=\"ref%d\">\n", ctx.ref_count);
+				print_format(out, "\t\t\t[<a href=\"#ref-return%d\">%d</a>] ", ctx.ref_count, ctx.chapter_ref_count);
+				print_html_text_block(&ctx, &doc->spans[reference->span]);
+				print_string(out, "\n\t\t</p>");
 			}
 		}
+
+		char detail[32];
+		snprintf(detail, sizeof(detail), "chapter%u", chapter_index + 1);
+		trace_end("html_chapter", detail, trace_start, out->size - chapter_offset);
 	}
 
-	fputs(
+	print_string(out,
 		"\n\t</body>\n"
-		"</html>",
-		f
+		"</html>"
 	);
 
-	fclose(f);
+	write_output(out, dir, filename);
+	pop_error_cleanup(out);
+	free_output_buffer(out);
+	arena_restore(scratch, mark);
 }
\ No newline at end of file
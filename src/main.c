@@ -1,50 +1,141 @@
-static char* load_file(const char* filepath)
+typedef struct
 {
+	const char*	text;
+	uint32_t	size;
+	size_t		mapping_size;	// Zero unless text is a file mapping, which must be unmapped when done
+} source_file;
+
+/*
+	Source text must end with a new line followed by a null terminator to make parsing simpler. The
+	tokeniser never writes to the source text, so where possible the file is mapped into memory
+	rather than copied, and pages are only read in as the tokeniser reaches them.
+*/
+static const char* map_file(const char* filepath, uint32_t* out_size, size_t* out_mapping_size)
+{
+#if !defined(_WIN32)
+	const int fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+		handle_error("Unable to open file \"%s\": %s.\n", filepath, strerror(errno));
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size <= 0 || info.st_size >= UINT32_MAX - 2)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	size_t size = (size_t)info.st_size;
+	const size_t granularity = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t mapping_size = (size + 2 + granularity - 1) & ~(granularity - 1);
+
+	/*
+		Reserve zeroed memory with room for the extra two bytes, then map the file privately over the
+		start of it. Everything past the end of the file reads as zero, so the null terminator comes
+		for free, and adding a missing final new line only copies the last page.
+	*/
+	char* data = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(data, mapping_size);
+		close(fd);
+		return nullptr;
+	}
+
+	close(fd);
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	if (data[size - 1] != '\n')
+		data[size++] = '\n';
+
+	*out_size = (uint32_t)size;
+	*out_mapping_size = mapping_size;
+
+	return data;
+#else
+	return nullptr;
+#endif
+}
+
+// Sources that can't be mapped are read into the arena, so are freed along with it
+static void load_file(arena* memory, const char* filepath, source_file* out)
+{
+	*out = (source_file){};
+
+	out->text = map_file(filepath, &out->size, &out->mapping_size);
+	if (out->text)
+		return;
+
 	FILE* f = open_file(filepath, file_mode_read);
-	const uint32_t size = get_file_size(f);
+	uint32_t size = get_file_size(f);
 
 	/*
 		Allocate enough memory plus two bytes:
 		1. Potential extra new line character before null terminator to make parsing simpler.
 		2. Null terminator.
 	*/
-	char* data = malloc(size + 2);
+	char* data = arena_alloc(memory, size + 2);
 
-	// Put data one byte past the beginning of the buffer to allow space for initial control code
 	fread(data, 1, size, f);
 	fclose(f);
 
 	// Check if final new line character needs to be added, then null terminate
-	if (data[size - 1] == '\n')
-	{
-		data[size] = 0;
-	}
-	else
-	{
-		data[size] = '\n';
-		data[size + 1] = 0;
-	}
+	if (size == 0 || data[size - 1] != '\n')
+		data[size++] = '\n';
 
-	return data;
+	data[size] = 0;
+
+	out->text = data;
+	out->size = size;
+}
+
+// Safe to call more than once, and on a source that was never loaded
+static void unload_file(source_file* source)
+{
+#if !defined(_WIN32)
+	if (source->mapping_size)
+		munmap((void*)source->text, source->mapping_size);
+#endif
+
+	*source = (source_file){};
 }
 
 static void print_usage(void)
 {
 	fprintf(stderr,
 		"Usage:\n"
-		"  press <src.txt> [--html|--epub]\n"
+		"  press <src.txt>... [--odt|--html|--epub]\n"
 		"\n"
 		"Flags:\n"
 		"  none    validates source file and produces no output\n"
 		"  --odt   generates ODT OpenDocument text file\n\n"
 		"  --html  generates HTML webpage\n\n"
 		"  --epub  generates ePub2 eBook\n\n"
+		"  --level=<0-9>\n"
+		"          compression level for ODT and ePub files, from 0 (none) to 9 (smallest), default 6\n\n"
+		"  --stats[=text|json]\n"
+		"          prints timings, counts and memory use for each document to stderr\n\n"
+		"  --trace <out.json>\n"
+		"          records stage, chapter and zip entry timings as Chrome trace events\n\n"
 	);
 
 	exit(EXIT_FAILURE);
 }
 
-static const char* copy_filename(const char* filepath)
+static int parse_level(const char* value)
+{
+	if (value[0] < '0' || value[0] > '9' || value[1] != 0)
+		handle_error("Compression level must be a number from 0 to 9.");
+
+	return value[0] - '0';
+}
+
+static const char* copy_filename(arena* memory, const char* filepath)
 {
 	assert(filepath);
 	assert(*filepath);
@@ -71,7 +162,7 @@ static const char* copy_filename(const char* filepath)
 	const int64_t len = last_dot - last_dir;
 	assert(len);
 
-	char* filename = malloc(len + 1);
+	char* filename = arena_alloc(memory, len + 1);
 	for (int64_t i = 0; i < len; ++i)
 		filename[i] = last_dir[i];
 	filename[len] = 0;
@@ -79,21 +170,514 @@ static const char* copy_filename(const char* filepath)
 	return filename;
 }
 
-static void delete_dir(const char* dir)
+typedef struct
+{
+	const char**	paths;
+	uint32_t		count;
+	uint32_t		capacity;
+} source_list;
+
+static void add_source(source_list* sources, const char* path)
+{
+	if (sources->count == sources->capacity)
+	{
+		sources->capacity = sources->capacity ? sources->capacity * 2 : 16;
+		sources->paths = mem_realloc(sources->paths, sizeof(const char*) * sources->capacity);
+	}
+
+	sources->paths[sources->count++] = path;
+}
+
+static int compare_paths(const void* a, const void* b)
+{
+	return strcmp(*(const char**)a, *(const char**)b);
+}
+
+/*
+	Adds the source files named by a command line argument. Directories add every .txt file they
+	contain. The Windows shell doesn't expand wildcards, so patterns are expanded here instead.
+	Returns true if the argument named more than a single file.
+*/
+static bool add_sources(source_list* sources, const char* arg)
+{
+	const uint32_t first = sources->count;
+
+#if defined(_WIN32)
+	const DWORD attributes = GetFileAttributesA(arg);
+	const bool is_dir = attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+
+	if (!is_dir && !strpbrk(arg, "*?"))
+	{
+		add_source(sources, arg);
+		return false;
+	}
+
+	// Matches are returned without their directory, so keep the directory part of the pattern
+	const char* pattern = is_dir ? generate_path("%s\\*.txt", arg) : arg;
+	const char* dir_end = is_dir ? nullptr : arg;
+	for (const char* c = arg; *c; ++c)
+	{
+		if (*c == '\\' || *c == '/')
+			dir_end = c + 1;
+	}
+
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA(pattern, &data);
+	if (find == INVALID_HANDLE_VALUE)
+		handle_error("No source files found matching \"%s\".", arg);
+
+	do
+	{
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		if (is_dir)
+			add_source(sources, generate_path("%s\\%s", arg, data.cFileName));
+		else
+			add_source(sources, generate_path("%.*s%s", (int)(dir_end - arg), arg, data.cFileName));
+	} while (FindNextFileA(find, &data));
+
+	FindClose(find);
+#else
+	struct stat info;
+	if (stat(arg, &info) != 0 || !S_ISDIR(info.st_mode))
+	{
+		add_source(sources, arg);
+		return false;
+	}
+
+	DIR* dir = opendir(arg);
+	if (!dir)
+		handle_error("Unable to open directory \"%s\": %s.", arg, strerror(errno));
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)))
+	{
+		const size_t len = strlen(entry->d_name);
+		if (len > 4 && strcmp(entry->d_name + len - 4, ".txt") == 0)
+			add_source(sources, generate_path("%s/%s", arg, entry->d_name));
+	}
+
+	closedir(dir);
+#endif
+
+	if (sources->count == first)
+		handle_error("No source files found in \"%s\".", arg);
+
+	// Directory order isn't defined, so sort to keep output and error reports stable
+	qsort(sources->paths + first, sources->count - first, sizeof(const char*), compare_paths);
+
+	return true;
+}
+
+typedef enum
+{
+	stats_format_none,
+	stats_format_text,
+	stats_format_json
+} stats_format;
+
+typedef struct
+{
+	int				level;
+	stats_format	stats;
+	bool			odt;
+	bool			html;
+	bool			epub;
+} press_options;
+
+typedef enum
+{
+	press_stage_load_file,
+	press_stage_tokenise,
+	press_stage_validate,
+	press_stage_generate_odt,
+	press_stage_generate_html,
+	press_stage_generate_epub,
+	press_stage_count
+} press_stage;
+
+static const char* const press_stage_names[press_stage_count] = {
+	"load_file",
+	"tokenise",
+	"validate",
+	"generate_odt",
+	"generate_html",
+	"generate_epub"
+};
+
+/*
+	Collected for every document since it only costs a few clock reads, and printed when requested
+	with --stats. Generators report the total size of the files they wrote.
+*/
+typedef struct
+{
+	uint64_t	stage_ns[press_stage_count];
+	uint64_t	stage_bytes[press_stage_count];
+	bool		stage_ran[press_stage_count];
+	uint32_t	input_bytes;
+	uint32_t	token_count;
+	uint32_t	chapter_count;
+	uint32_t	element_count;
+	uint32_t	reference_count;
+} press_stats;
+
+typedef struct
+{
+	uint64_t	start_ns;
+	uint64_t	start_bytes;
+} stage_timer;
+
+static stage_timer begin_stage(void)
+{
+	return (stage_timer){
+		.start_bytes	= get_bytes_written(),
+		.start_ns		= get_time_ns()
+	};
+}
+
+static void end_stage(press_stats* stats, press_stage stage, const stage_timer* timer, const char* filepath)
+{
+	stats->stage_ns[stage] = get_time_ns() - timer->start_ns;
+	stats->stage_bytes[stage] = get_bytes_written() - timer->start_bytes;
+	stats->stage_ran[stage] = true;
+
+	// Generators are tagged with the bytes they wrote and earlier stages with the bytes they read
+	const uint64_t bytes = stats->stage_bytes[stage] ? stats->stage_bytes[stage] : stats->input_bytes;
+	trace_end(press_stage_names[stage], filepath, timer->start_ns, bytes);
+}
+
+/*
+	Everything that lives as long as the document is allocated from the thread's document arena,
+	which callers reset before each document. The source is loaded into the caller's source_file so
+	that a caller recovering from an error can still unload it.
+*/
+static void press_document(const char* filepath, const char* dir, const press_options* options, source_file* source, press_stats* stats)
+{
+	arena* memory = get_document_arena();
+
+	const uint64_t trace_start = trace_begin();
+
+	stage_timer timer = begin_stage();
+	load_file(memory, filepath, source);
+	const char* text = source->text;
+	const uint32_t size = source->size;
+	stats->input_bytes = size;
+	end_stage(stats, press_stage_load_file, &timer, filepath);
+
+	document doc = {};
+
+	timer = begin_stage();
+	line_tokens tokens;
+	tokenise(text, size, memory, &tokens, &doc.metadata);
+	end_stage(stats, press_stage_tokenise, &timer, filepath);
+
+	// Default to article to allow small documents without any metadata
+	if (doc.metadata.type == document_type_none)
+		doc.metadata.type = document_type_article;
+
+	timer = begin_stage();
+	validate(&tokens, memory, &doc);
+	end_stage(stats, press_stage_validate, &timer, filepath);
+
+	if (!doc.metadata.title)
+		doc.metadata.title = copy_filename(memory, filepath);
+
+	stats->token_count = tokens.count;
+	stats->chapter_count = doc.chapter_count;
+	for (uint32_t i = 0; i < doc.chapter_count; ++i)
+	{
+		stats->element_count += doc.chapters[i].element_count;
+		stats->reference_count += doc.chapters[i].reference_count;
+	}
+
+	if (options->odt)
+	{
+		timer = begin_stage();
+		generate_odt(&doc, dir, options->level);
+		end_stage(stats, press_stage_generate_odt, &timer, filepath);
+	}
+	if (options->html)
+	{
+		timer = begin_stage();
+		generate_html(&doc, dir);
+		end_stage(stats, press_stage_generate_html, &timer, filepath);
+	}
+	if (options->epub)
+	{
+		timer = begin_stage();
+		generate_epub(&doc, dir, options->level);
+		end_stage(stats, press_stage_generate_epub, &timer, filepath);
+	}
+
+	unload_file(source);
+
+	trace_end("press_document", filepath, trace_start, size);
+}
+
+static stats_format parse_stats_format(const char* value)
+{
+	if (strcmp(value, "text") == 0)
+		return stats_format_text;
+	if (strcmp(value, "json") == 0)
+		return stats_format_json;
+
+	handle_error("Statistics format must be \"text\" or \"json\".");
+	return stats_format_none;
+}
+
+static double get_mb_per_s(uint64_t bytes, uint64_t ns)
+{
+	return ns ? bytes / (ns / 1e9) / 1e6 : 0;
+}
+
+static void print_stats_text(const char* filepath, const press_stats* stats)
+{
+	fprintf(stderr, "%s:\n", filepath);
+
+	for (int i = 0; i < press_stage_count; ++i)
+	{
+		if (!stats->stage_ran[i])
+			continue;
+
+		fprintf(stderr, "  %-15s %10.3f ms %10.2f MB/s", press_stage_names[i], stats->stage_ns[i] / 1e6, get_mb_per_s(stats->input_bytes, stats->stage_ns[i]));
+		if (stats->stage_bytes[i])
+			fprintf(stderr, " %12llu bytes written", (unsigned long long)stats->stage_bytes[i]);
+		fputc('\n', stderr);
+	}
+
+	fprintf(stderr,
+		"  input bytes     %10u\n"
+		"  line tokens     %10u\n"
+		"  chapters        %10u\n"
+		"  elements        %10u\n"
+		"  references      %10u\n",
+		stats->input_bytes, stats->token_count, stats->chapter_count, stats->element_count, stats->reference_count
+	);
+}
+
+static void print_stats_json(const char* filepath, const press_stats* stats)
+{
+	fprintf(stderr, "\t\t{\n\t\t\t\"path\": ");
+	print_json_string(stderr, filepath);
+	fprintf(stderr,
+		",\n"
+		"\t\t\t\"input_bytes\": %u,\n"
+		"\t\t\t\"line_tokens\": %u,\n"
+		"\t\t\t\"chapters\": %u,\n"
+		"\t\t\t\"elements\": %u,\n"
+		"\t\t\t\"references\": %u,\n"
+		"\t\t\t\"stages\": {",
+		stats->input_bytes, stats->token_count, stats->chapter_count, stats->element_count, stats->reference_count
+	);
+
+	bool first = true;
+	for (int i = 0; i < press_stage_count; ++i)
+	{
+		if (!stats->stage_ran[i])
+			continue;
+
+		fprintf(stderr,
+			"%s\n\t\t\t\t\"%s\": { \"ns\": %llu, \"mb_per_s\": %.2f, \"bytes_written\": %llu }",
+			first ? "" : ",",
+			press_stage_names[i],
+			(unsigned long long)stats->stage_ns[i],
+			get_mb_per_s(stats->input_bytes, stats->stage_ns[i]),
+			(unsigned long long)stats->stage_bytes[i]
+		);
+		first = false;
+	}
+
+	fprintf(stderr, "\n\t\t\t}\n\t\t}");
+}
+
+
+typedef struct
+{
+	const char*		filepath;
+	const char*		dir;
+	bool			failed;
+	source_file		source;
+	press_stats		stats;
+	error_context	error;
+} press_job;
+
+typedef struct
+{
+	press_job*				jobs;
+	const press_options*	options;
+} press_batch;
+
+/*
+	Statistics go to stderr so that stdout stays the same with or without them, and JSON can be
+	captured on its own. Documents that failed in a batch have no statistics and are skipped.
+*/
+static void print_stats(stats_format format, const press_job* jobs, uint32_t count)
+{
+	if (format == stats_format_json)
+		fprintf(stderr, "{\n\t\"documents\": [\n");
+
+	bool first = true;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const press_job* job = &jobs[i];
+		if (job->failed)
+			continue;
+
+		if (format == stats_format_json)
+		{
+			if (!first)
+				fprintf(stderr, ",\n");
+			print_stats_json(job->filepath, &job->stats);
+		}
+		else
+		{
+			print_stats_text(job->filepath, &job->stats);
+		}
+
+		first = false;
+	}
+
+	const uint64_t peak_rss = get_peak_rss();
+	if (format == stats_format_json)
+		fprintf(stderr, "\n\t],\n\t\"peak_rss_bytes\": %llu\n}\n", (unsigned long long)peak_rss);
+	else
+		fprintf(stderr, "peak RSS: %.2f MB\n", peak_rss / 1e6);
+}
+
+/*
+	Each document in a batch is converted independently, writing to its own directory named after
+	the source file. Errors end the job rather than the process so they can all be reported once
+	every document has been processed.
+*/
+static void run_press_job(void* data, uint32_t index)
+{
+	press_batch* batch = data;
+	press_job* job = &batch->jobs[index];
+
+	if (setjmp(job->error.recover) == 0)
+	{
+		set_error_context(&job->error);
+
+		// Reclaims everything the last document on this thread used, even if it failed part way
+		arena* memory = get_document_arena();
+		arena_reset(memory);
+		arena_reset(get_scratch_arena());
+
+		if (job->dir)
+			create_dir(job->dir);
+
+		press_document(job->filepath, job->dir, batch->options, &job->source, &job->stats);
+	}
+	else
+	{
+		job->failed = true;
+
+		// The source is still mapped if the document failed after loading it
+		unload_file(&job->source);
+	}
+
+	set_error_context(nullptr);
+}
+
+// Output directories are compared ignoring ASCII case, since Windows and macOS would merge them
+static int compare_job_dirs(const void* a, const void* b)
+{
+	const char* x = (*(const press_job**)a)->dir;
+	const char* y = (*(const press_job**)b)->dir;
+
+	for (;; ++x, ++y)
+	{
+		const char cx = *x >= 'A' && *x <= 'Z' ? *x + ('a' - 'A') : *x;
+		const char cy = *y >= 'A' && *y <= 'Z' ? *y + ('a' - 'A') : *y;
+		if (cx != cy || cx == 0)
+			return (unsigned char)cx - (unsigned char)cy;
+	}
+}
+
+/*
+	Every job writes to a directory named after its source file, so two sources with the same name
+	in different directories would write over each other's output. Those are reported before any
+	job starts rather than leaving one document silently replaced.
+*/
+static void check_job_dirs(press_job* jobs, uint32_t count)
+{
+	press_job** sorted = mem_alloc(sizeof(press_job*) * count);
+	for (uint32_t i = 0; i < count; ++i)
+		sorted[i] = &jobs[i];
+
+	qsort(sorted, count, sizeof(press_job*), compare_job_dirs);
+
+	for (uint32_t i = 1; i < count; ++i)
+	{
+		if (compare_job_dirs(&sorted[i - 1], &sorted[i]) == 0)
+		{
+			handle_error(
+				"\"%s\" and \"%s\" would both be written to \"%s\". Rename one of them or convert them separately.",
+				sorted[i - 1]->filepath, sorted[i]->filepath, sorted[i]->dir
+			);
+		}
+	}
+
+	mem_free(sorted);
+}
+
+static void press_batch_documents(const source_list* sources, const press_options* options)
 {
-	char buffer[256];
-	const int len = snprintf(buffer, sizeof(buffer), "rmdir %s /s /q >nul 2>nul", dir);
-	assert(len < sizeof(buffer));
+	press_batch batch = {
+		.jobs		= mem_calloc(sources->count, sizeof(press_job)),
+		.options	= options
+	};
+
+	// Job arenas are reset per document, so directory names live until the batch is done
+	arena names = {};
+	const bool has_output = options->odt || options->html || options->epub;
+
+	for (uint32_t i = 0; i < sources->count; ++i)
+	{
+		press_job* job = &batch.jobs[i];
+		job->filepath = sources->paths[i];
+		if (has_output)
+			job->dir = arena_format(&names, OUTPUT_DIR "/%s", copy_filename(&names, job->filepath));
+	}
+
+	if (has_output)
+		check_job_dirs(batch.jobs, sources->count);
 
-	system(buffer);
+	run_jobs(run_press_job, &batch, sources->count);
+	arena_free(&names);
+
+	if (options->stats)
+		print_stats(options->stats, batch.jobs, sources->count);
+
+	uint32_t failed_count = 0;
+	for (uint32_t i = 0; i < sources->count; ++i)
+	{
+		const press_job* job = &batch.jobs[i];
+		if (job->failed)
+		{
+			fprintf(stderr, "%s:\n%s\n", job->filepath, job->error.message);
+			++failed_count;
+		}
+	}
+
+	if (failed_count)
+	{
+		fprintf(stderr, "%u of %u documents failed.\n", failed_count, sources->count);
+		exit(EXIT_FAILURE);
+	}
 }
 
+// Tools built from the unity file supply their own entry point
+#if !defined(PRESS_NO_MAIN)
 int main(int argc, const char** argv)
 {
-	bool odt = false;
-	bool html = false;
-	bool epub = false;
-	const char* filepath = nullptr;
+	press_options options = {
+		.level = 6
+	};
+	source_list sources = {};
+	const char* trace_file = nullptr;
+	bool batch = false;
 
 	fputs("ARCP Press Tool v0.9.1\n", stdout);
 
@@ -105,63 +689,61 @@ int main(int argc, const char** argv)
 		if (*argv[i] == '-')
 		{
 			if (strcmp(argv[i], "--odt") == 0)
-				odt = true;
+				options.odt = true;
 			else if (strcmp(argv[i], "--html") == 0)
-				html = true;
+				options.html = true;
 			else if (strcmp(argv[i], "--epub") == 0)
-				epub = true;
+				options.epub = true;
+			else if (strncmp(argv[i], "--level=", 8) == 0)
+				options.level = parse_level(argv[i] + 8);
+			else if (strcmp(argv[i], "--stats") == 0)
+				options.stats = stats_format_text;
+			else if (strncmp(argv[i], "--stats=", 8) == 0)
+				options.stats = parse_stats_format(argv[i] + 8);
+			else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+				trace_file = argv[++i];
+			else if (strncmp(argv[i], "--trace=", 8) == 0)
+				trace_file = argv[i] + 8;
 			else
 				handle_error("Unsupported argument \"%s\".", argv[i]);
 		}
 		else
 		{
-			if (filepath)
-				handle_error("Only a single source file is currently supported.");
-
-			filepath = argv[i];
+			batch |= add_sources(&sources, argv[i]);
 		}
 	}
 
-	if (!filepath)
+	if (sources.count == 0)
 		handle_error("No source file specified.");
 
-	char* text = load_file(filepath);
-
-	document doc = {};
-
-	line_tokens tokens;
-	tokenise(text, &tokens, &doc.metadata);
-
-	// Default to article to allow small documents without any metadata
-	if (doc.metadata.type == document_type_none)
-		doc.metadata.type = document_type_article;
+	batch |= sources.count > 1;
 
-	doc_mem_req mem_req;
-	validate(&tokens, &mem_req);
+	if (trace_file)
+		start_trace(trace_file);
 
-	finalise(&tokens, &mem_req, &doc);
-
-	if (!doc.metadata.title)
-		doc.metadata.title = copy_filename(filepath);
+	// Each generator replaces its own outputs, so anything else in the output directory is kept
+	const bool generate = options.odt || options.html || options.epub;
+	if (generate)
+		create_dir(output_dir);
 
-	if (odt || html || epub)
+	if (batch)
+		press_batch_documents(&sources, &options);
+	else
 	{
-		delete_dir(output_dir);
-		create_dir(output_dir);
+		press_job job = {
+			.filepath	= sources.paths[0]
+		};
+		press_document(job.filepath, output_dir, &options, &job.source, &job.stats);
 
-		if (odt)
-			generate_odt(&doc);
-		if (html)
-			generate_html(&doc);
-		if (epub)
-			generate_epub(&doc);
+		if (options.stats)
+			print_stats(options.stats, &job, 1);
+	}
 
+	if (generate)
 		printf("Generation successful\n");
-	}
 	else
-	{
 		printf("Validation successful\n");
-	}
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+#endif
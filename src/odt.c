@@ -1,32 +1,26 @@
-static void create_odt_mimetype(void)
+static void create_odt_mimetype(output_buffer* out, zip_writer* zip)
 {
-	FILE* f = open_file(OUTPUT_DIR "/odt/mimetype", file_mode_write);
-	fputs("application/vnd.oasis.opendocument.text", f);
-	fclose(f);
+	print_string(out, "application/vnd.oasis.opendocument.text");
+	zip_write_output(zip, out, "mimetype", zip_compression_store);
 }
 
-static void create_odt_meta_inf(void)
+static void create_odt_meta_inf(output_buffer* out, zip_writer* zip)
 {
-	FILE* f = open_file(OUTPUT_DIR "/odt/META-INF/manifest.xml", file_mode_write);
-
-	fputs(
+	print_string(out,
 		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
 		"<manifest:manifest xmlns:manifest=\"urn:oasis:names:tc:opendocument:xmlns:manifest:1.0\" manifest:version=\"1.3\">\n"
 		"\t<manifest:file-entry manifest:full-path=\"/\" manifest:version=\"1.3\" manifest:media-type=\"application/vnd.oasis.opendocument.text\"/>\n"
 		"\t<manifest:file-entry manifest:full-path=\"styles.xml\" manifest:media-type=\"text/xml\"/>\n"
 		"\t<manifest:file-entry manifest:full-path=\"content.xml\" manifest:media-type=\"text/xml\"/>\n"
-		"</manifest:manifest>",
-		f
+		"</manifest:manifest>"
 	);
 
-	fclose(f);
+	zip_write_output(zip, out, "META-INF/manifest.xml", zip_compression_deflate);
 }
 
-static void create_odt_styles(void)
+static void create_odt_styles(output_buffer* out, zip_writer* zip)
 {
-	FILE* f = open_file(OUTPUT_DIR "/odt/styles.xml", file_mode_write);
-
-	fputs(
+	print_string(out,
 		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
 		"<office:document-styles xmlns:office=\"urn:oasis:names:tc:opendocument:xmlns:office:1.0\" xmlns:fo=\"urn:oasis:names:tc:opendocument:xmlns:xsl-fo-compatible:1.0\" xmlns:style=\"urn:oasis:names:tc:opendocument:xmlns:style:1.0\" xmlns:svg=\"urn:oasis:names:tc:opendocument:xmlns:svg-compatible:1.0\" office:version=\"1.3\">\n"
 		"\t<office:font-face-decls>\n"
@@ -95,34 +89,43 @@ static void create_odt_styles(void)
 		"\t\t<style:master-page style:name=\"Standard\" style:page-layout-name=\"Letter\"/>\n"
 		"\t\t<style:master-page style:name=\"First_Page\" style:display-name=\"First Page\" style:page-layout-name=\"Letter_Cover\" style:next-style-name=\"Standard\"/>\n"
 		"\t</office:master-styles>\n"
-		"</office:document-styles>",
-		f
+		"</office:document-styles>"
 	);
 
-	fclose(f);
+	zip_write_output(zip, out, "styles.xml", zip_compression_deflate);
 }
 
-static void print_odt_text_block(FILE* f, const char* text)
+static void print_odt_text_block(output_buffer* out, const document* doc, const text_span* span)
 {
-	while (*text)
+	const char* text = doc->text + span->offset;
+	const uint32_t* controls = doc->controls + span->first_control;
+	uint32_t pos = 0;
+
+	for (uint32_t i = 0; i < span->control_count; ++i)
 	{
-		if (*text == text_token_type_strong_begin)
+		// Copy plain text in bulk up to the next text token or apostrophe
+		const uint32_t control = controls[i];
+		print_bytes(out, text + pos, control - pos);
+		pos = control + 1;
+
+		const char c = text[control];
+		if (c == text_token_type_strong_begin)
 		{
-			fputs("<text:span text:style-name=\"Strong\">", f);
+			print_string(out, "<text:span text:style-name=\"Strong\">");
 		}
-		else if (*text == text_token_type_strong_end)
+		else if (c == text_token_type_strong_end)
 		{
-			fputs("</text:span>", f);
+			print_string(out, "</text:span>");
 		}
-		else if (*text == text_token_type_emphasis_begin)
+		else if (c == text_token_type_emphasis_begin)
 		{
-			fputs("<text:span text:style-name=\"Emphasis\">", f);
+			print_string(out, "<text:span text:style-name=\"Emphasis\">");
 		}
-		else if (*text == text_token_type_emphasis_end)
+		else if (c == text_token_type_emphasis_end)
 		{
-			fputs("</text:span>", f);
+			print_string(out, "</text:span>");
 		}
-		else if (*text == text_token_type_reference)
+		else if (c == text_token_type_reference)
 		{
 //			const uint32_t ref_count = ctx->inline_ref_count++ + 1;
 //			const uint32_t chapter_ref_count = ctx->inline_chapter_ref_count++;
@@ -130,67 +133,67 @@ static void print_odt_text_block(FILE* f, const char* text)
 //			const document_chapter* chapter = &ctx->doc->chapters[ctx->chapter_index];
 //			const document_reference* reference = &chapter->references[chapter_ref_count];
 //
-//			fprintf(ctx->f, "<sup><a id=\"ref-return%d\" href=\"#ref%d\" title=\"", ref_count, ref_count);
-//			print_simple_text(ctx->f, reference->text);
-//			fprintf(ctx->f, "\">[%d]</a></sup>", chapter_ref_count + 1);
+//			print_format(ctx->out, "<sup><a id=\"ref-return%d\" href=\"#ref%d\" title=\"", ref_count, ref_count);
+//			print_simple_text(ctx->out, ctx->doc, &ctx->doc->spans[reference->span]);
+//			print_format(ctx->out, "\">[%d]</a></sup>", chapter_ref_count + 1);
 		}
 		else
 		{
-			print_char(f, *text);
+			print_char(out, c);
 		}
-
-		++text;
 	}
+
+	print_bytes(out, text + pos, span->length - pos);
 }
 
-static void generate_odt_content(const document* doc)
+static void generate_odt_content(output_buffer* out, zip_writer* zip, const document* doc)
 {
-	FILE* f = open_file(OUTPUT_DIR "/odt/content.xml", file_mode_write);
-
 	html_context ctx = {
-		.f		= f,
+		.out	= out,
 		.doc	= doc
 	};
 
-	fputs(
+	// Content holds the whole document, so it is passed to the archive a chapter at a time
+	zip_begin_entry(zip, "content.xml", zip_compression_deflate);
+
+	print_string(out,
 		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
 		"<office:document-content xmlns:office=\"urn:oasis:names:tc:opendocument:xmlns:office:1.0\" xmlns:text=\"urn:oasis:names:tc:opendocument:xmlns:text:1.0\" office:version=\"1.3\">\n"
 		"\t<office:body>\n"
-		"\t\t<office:text>",
-		f
+		"\t\t<office:text>"
 	);
 
 //	if (doc->metadata.type == document_type_book)
 //	{
 //		if (doc->metadata.title)
-//			fprintf(f, "\n\t\t<h1 class=\"title\">%s</h1>", doc->metadata.title);
+//			print_format(out, "\n\t\t<h1 class=\"title\">%s</h1>", doc->metadata.title);
 //
 //		if (doc->metadata.author_count)
 //		{
-//			fprintf(f, "\n\t\t<p class=\"authors\">");
+//			print_string(out, "\n\t\t<p class=\"authors\">");
 //
 //			for (uint32_t i = 0; i < doc->metadata.author_count - 1; ++i)
-//				fprintf(f, "\n\t\t\t%s<br>", doc->metadata.authors[i]);
-//			fprintf(f, "\n\t\t\t%s", doc->metadata.authors[doc->metadata.author_count - 1]);
+//				print_format(out, "\n\t\t\t%s<br>", doc->metadata.authors[i]);
+//			print_format(out, "\n\t\t\t%s", doc->metadata.authors[doc->metadata.author_count - 1]);
 //
-//			fprintf(f, "\n\t\t</p>");
+//			print_string(out, "\n\t\t</p>");
 //		}
 //
 //		if (doc->metadata.translator_count)
 //		{
-//			fprintf(f, "\n\t\t<p class=\"authors\">");
-//			fprintf(f, "\n\t\t\tTranslated by:<br>");
+//			print_string(out, "\n\t\t<p class=\"authors\">");
+//			print_string(out, "\n\t\t\tTranslated by:<br>");
 //
 //			for (uint32_t i = 0; i < doc->metadata.translator_count - 1; ++i)
-//				fprintf(f, "\n\t\t\t%s<br>", doc->metadata.translators[i]);
-//			fprintf(f, "\n\t\t\t%s", doc->metadata.translators[doc->metadata.translator_count - 1]);
+//				print_format(out, "\n\t\t\t%s<br>", doc->metadata.translators[i]);
+//			print_format(out, "\n\t\t\t%s", doc->metadata.translators[doc->metadata.translator_count - 1]);
 //
-//			fprintf(f, "\n\t\t</p>");
+//			print_string(out, "\n\t\t</p>");
 //		}
 //
 //		if (doc->chapter_count > 1)
 //		{
-//			fprintf(f,
+//			print_string(out,
 //				"\n\t\t<h1>Contents</h1>\n"
 //				"\t\t<p>\n"
 //				"\t\t\t<ul class=\"chapters\">\n"
@@ -198,14 +201,12 @@ static void generate_odt_content(const document* doc)
 //
 //			for (uint32_t chapter_index = 0; chapter_index < doc->chapter_count; ++chapter_index)
 //			{
-//				document_element* heading = doc->chapters[chapter_index].elements;
-//
-//				fprintf(f, "\t\t\t\t<li><a href=\"#h%d\">", chapter_index + 1);
-//				print_simple_text(ctx.f, heading->text);
-//				fprintf(f, "</a></li>\n");
+//				print_format(out, "\t\t\t\t<li><a href=\"#h%d\">", chapter_index + 1);
+//				print_simple_text(ctx.out, doc, get_chapter_title(doc, chapter_index));
+//				print_string(out, "</a></li>\n");
 //			}
 //
-//			fprintf(f,
+//			print_string(out,
 //				"\t\t\t</ul>\n"
 //				"\t\t</p>"
 //			);
@@ -218,81 +219,87 @@ static void generate_odt_content(const document* doc)
 
 	for (uint32_t chapter_index = 0; chapter_index < doc->chapter_count; ++chapter_index)
 	{
+		const uint64_t trace_start = trace_begin();
+
 		document_chapter* chapter = &doc->chapters[chapter_index];
 		ctx.chapter_index = chapter_index;
 
+		// Only elements that carry text have a span, so they are read in order
+		const uint32_t* span_index = chapter->text_spans;
+
 		for (uint32_t element_index = 0; element_index < chapter->element_count; ++element_index)
 		{
-			document_element* element = &chapter->elements[element_index];
+			const document_element_type type = chapter->element_types[element_index];
+			const text_span* span = is_text_element(type) ? &doc->spans[*span_index++] : nullptr;
 
-			switch (element->type)
+			switch (type)
 			{
 			case document_element_type_heading_1:
 				paragraph_count = 0;
 				ctx.chapter_ref_count = 0;
 				ctx.inline_chapter_ref_count = 0;
 
-				print_tabs(f, depth);
-				fputs("<text:h text:style-name=\"Heading_1\" text:outline-level=\"1\">", f);
-				print_odt_text_block(f, element->text);
-				fprintf(f, "</text:h>");
+				print_tabs(out, depth);
+				print_string(out, "<text:h text:style-name=\"Heading_1\" text:outline-level=\"1\">");
+				print_odt_text_block(out, doc, span);
+				print_string(out, "</text:h>");
 				break;
 			case document_element_type_heading_2:
 				paragraph_count = 0;
 
-				print_tabs(f, depth);
-				fputs("<text:h text:style-name=\"Heading_2\" text:outline-level=\"2\">", f);
-				print_odt_text_block(f, element->text);
-				fprintf(f, "</text:h>");
+				print_tabs(out, depth);
+				print_string(out, "<text:h text:style-name=\"Heading_2\" text:outline-level=\"2\">");
+				print_odt_text_block(out, doc, span);
+				print_string(out, "</text:h>");
 				break;
 			case document_element_type_heading_3:
 				paragraph_count = 0;
 
-				print_tabs(f, depth);
-				fputs("<text:h text:style-name=\"Heading_3\" text:outline-level=\"3\">", f);
-				print_odt_text_block(f, element->text);
-				fprintf(f, "</text:h>");
+				print_tabs(out, depth);
+				print_string(out, "<text:h text:style-name=\"Heading_3\" text:outline-level=\"3\">");
+				print_odt_text_block(out, doc, span);
+				print_string(out, "</text:h>");
 				break;
 			case document_element_type_text_block:
-				print_odt_text_block(f, element->text);
+				print_odt_text_block(out, doc, span);
 				break;
 			case document_element_type_line_break:
-				fputs("<text:line-break/>", f);
+				print_string(out, "<text:line-break/>");
 				break;
 			case document_element_type_paragraph_begin:
 				++paragraph_count;
 
-				print_tabs(f, depth);
+				print_tabs(out, depth);
 
 				if (paragraph_count == 1)
 				{
 					if (inside_blockquote)
-						fputs("<text:p text:style-name=\"Blockquote\">", f);
+						print_string(out, "<text:p text:style-name=\"Blockquote\">");
 					else
-						fputs("<text:p text:style-name=\"First_Paragraph\">", f);
+						print_string(out, "<text:p text:style-name=\"First_Paragraph\">");
 				}
 				else
 				{
 					if (inside_blockquote)
-						fputs("<text:p text:style-name=\"Blockquote_Indent\">", f);
+						print_string(out, "<text:p text:style-name=\"Blockquote_Indent\">");
 					else
-						fputs("<text:p text:style-name=\"Indent_Paragraph\">", f);
+						print_string(out, "<text:p text:style-name=\"Indent_Paragraph\">");
 				}
 
 				break;
 			case document_element_type_paragraph_break_begin:
 				paragraph_count = 1;
 
-				print_tabs(f, depth);
+				print_tabs(out, depth);
 
 				if (inside_blockquote)
-					fputs("<text:p text:style-name=\"Blockquote\">", f);
+					print_string(out, "<text:p text:style-name=\"Blockquote\">");
 				else
-					fputs("<text:p text:style-name=\"First_Paragraph\">", f);
+					print_string(out, "<text:p text:style-name=\"First_Paragraph\">");
 
 				break;
 			case document_element_type_paragraph_end:
-				fputs("</text:p>", f);
+				print_string(out, "</text:p>");
 				break;
 			case document_element_type_blockquote_begin:
 				paragraph_count = 0;
@@ -303,39 +310,39 @@ static void generate_odt_content(const document* doc)
 				inside_blockquote = false;
 				break;
 			case document_element_type_blockquote_citation:
-				print_tabs(f, depth);
-				fputs("<text:p text:style-name=\"Blockquote_Reference\">", f);
-				print_em_dash(f);
-				print_odt_text_block(f, element->text);
-				fputs("</text:p>", f);
+				print_tabs(out, depth);
+				print_string(out, "<text:p text:style-name=\"Blockquote_Reference\">");
+				print_em_dash(out);
+				print_odt_text_block(out, doc, span);
+				print_string(out, "</text:p>");
 				break;
 //			case document_element_type_ordered_list_begin_roman:
-//				print_tabs(f, depth++);
-//				fputs("<ol type=\"I\">", f);
+//				print_tabs(out, depth++);
+//				print_string(out, "<ol type=\"I\">");
 //				break;
 //			case document_element_type_ordered_list_begin_arabic:
-//				print_tabs(f, depth++);
-//				fputs("<ol>", f);
+//				print_tabs(out, depth++);
+//				print_string(out, "<ol>");
 //				break;
 //			case document_element_type_ordered_list_begin_letter:
-//				print_tabs(f, depth++);
-//				fputs("<ol type=\"a\">", f);
+//				print_tabs(out, depth++);
+//				print_string(out, "<ol type=\"a\">");
 //				break;
 //			case document_element_type_ordered_list_end:
-//				print_tabs(f, --depth);
-//				fputs("</ol>", f);
+//				print_tabs(out, --depth);
+//				print_string(out, "</ol>");
 //				break;
 //			case document_element_type_unordered_list_begin:
-//				print_tabs(f, depth++);
-//				fputs("<ul>", f);
+//				print_tabs(out, depth++);
+//				print_string(out, "<ul>");
 //				break;
 //			case document_element_type_unordered_list_end:
-//				print_tabs(f, --depth);
-//				fputs("</ul>", f);
+//				print_tabs(out, --depth);
+//				print_string(out, "</ul>");
 //				break;
 //			case document_element_type_list_item:
-//				print_tabs(f, depth);
-//				fprintf(f, "<li>%s</li>", element->text);
+//				print_tabs(out, depth);
+//				print_format(out, "<li>%s</li>", doc->text + span->offset);
 //				break;
 			}
 		}
@@ -348,48 +355,54 @@ static void generate_odt_content(const document* doc)
 //				++ctx.chapter_ref_count;
 //
 //				document_reference* reference = &chapter->references[reference_index];
-//				fprintf(f, "\n\t\t<p class=\"footnote\" id=\"ref%d\">\n", ctx.ref_count);
-//				fprintf(f, "\t\t\t[<a href=\"#ref-return%d\">%d</a>] ", ctx.ref_count, ctx.chapter_ref_count);
-//				print_html_text_block(&ctx, reference->text);
-//				fprintf(f, "\n\t\t</p>");
+//				print_format(out, "\n\t\t<p class=\"footnote\" id=\"ref%d\">\n", ctx.ref_count);
+//				print_format(out, "\t\t\t[<a href=\"#ref-return%d\">%d</a>] ", ctx.ref_count, ctx.chapter_ref_count);
+//				print_html_text_block(&ctx, &doc->spans[reference->span]);
+//				print_string(out, "\n\t\t</p>");
 //			}
 //		}
+
+		char detail[32];
+		snprintf(detail, sizeof(detail), "chapter%u", chapter_index + 1);
+		trace_end("odt_chapter", detail, trace_start, out->size);
+
+		zip_write_buffer(zip, out);
 	}
 
-	fputs(
+	print_string(out,
 		"\n"
 		"\t\t</office:text>\n"
 		"\t</office:body>\n"
-		"</office:document-content>",
-		f
+		"</office:document-content>"
 	);
 
-	fclose(f);
+	zip_write_buffer(zip, out);
+	zip_end_entry(zip);
 }
 
-static void generate_odt(const document* doc)
+static void generate_odt(const document* doc, const char* dir, int level)
 {
-	delete_dir(OUTPUT_DIR "\\odt");
-	create_dir(OUTPUT_DIR "\\odt\\META-INF");
-
-	create_odt_mimetype();
-	create_odt_meta_inf();
-	create_odt_styles();
-	generate_odt_content(doc);
-
-	const char* inputs[] = {
-		OUTPUT_DIR "/odt/mimetype",
-		OUTPUT_DIR "/odt/META-INF/manifest.xml",
-		OUTPUT_DIR "/odt/styles.xml",
-		OUTPUT_DIR "/odt/content.xml"
-	};
+	arena* scratch = get_scratch_arena();
+	const arena_mark mark = arena_get_mark(scratch);
 
-	const char* outputs[] = {
-		"mimetype",
-		"META-INF/manifest.xml",
-		"styles.xml",
-		"content.xml"
-	};
+	const char* filename = generate_url_filename(scratch, doc->metadata.title, "odt");
+
+	const char* filepath = arena_format(scratch, "%s/%s", dir, filename);
+
+	zip_writer zip;
+	zip_begin(&zip, scratch, filepath, level);
+
+	output_buffer buffer = {};
+	output_buffer* out = &buffer;
+	push_error_cleanup(free_output_buffer, out);
+
+	create_odt_mimetype(out, &zip);
+	create_odt_meta_inf(out, &zip);
+	create_odt_styles(out, &zip);
+	generate_odt_content(out, &zip, doc);
 
-	generate_zip(OUTPUT_DIR "\\test.odt", inputs, outputs, 4);
+	zip_end(&zip);
+	pop_error_cleanup(out);
+	free_output_buffer(out);
+	arena_restore(scratch, mark);
 }
\ No newline at end of file
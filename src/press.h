@@ -1,14 +1,59 @@
+#if !defined(_WIN32)
+	#define _GNU_SOURCE		// Expose POSIX and platform extensions such as MAP_ANONYMOUS
+#endif
+
 #include <time.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 #include <setjmp.h>
 #include <assert.h>
 #include <stdbool.h>
 
+#if defined(_WIN32)
+	#define NOMINMAX
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#include <psapi.h>
+#else
+	#include <ftw.h>
+	#include <fcntl.h>
+	#include <dirent.h>
+	#include <unistd.h>
+	#include <pthread.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/resource.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define SIMD_SSE2
+	#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+	#define SIMD_AVX2
+	#include <immintrin.h>
+#endif
+
+// Instructions that are used when the CPU supports them, checked at runtime
+#if defined(__x86_64__) || defined(_M_X64)
+	#define CPU_X64
+	#include <wmmintrin.h>
+
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+		#define TARGET_PCLMUL
+	#else
+		#include <cpuid.h>
+		#define TARGET_PCLMUL __attribute__((target("pclmul")))
+	#endif
+#endif
+
 #if __STDC_VERSION__ < 202311		// <C23
 	#define nullptr ((void*)0)
 #endif
@@ -21,6 +66,14 @@
 	#define noreturn
 #endif
 
+#if __STDC_VERSION__ >= 202311		// >=C23
+	// thread_local is a keyword
+#elif defined(_MSC_VER)
+	#define thread_local __declspec(thread)
+#else
+	#define thread_local _Thread_local
+#endif
+
 enum
 {
 	page_size = 2 << 20
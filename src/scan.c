@@ -0,0 +1,491 @@
+/*
+	Vectorised scanning helpers for the tokeniser. Each function has an AVX2 and SSE2 path selected
+	at compile time, plus a scalar fallback for other targets.
+
+	The SIMD scanning paths only ever load aligned blocks, which can never straddle a page boundary,
+	so they may safely read past the null terminator at the end of the buffer. UTF-8 validation runs
+	over an exact size instead, and copies the last partial block.
+*/
+
+static uint32_t count_trailing_zeros(uint32_t mask)
+{
+	assert(mask);
+
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+/*
+	Characters that may need special handling when tokenising text: markup characters, spaces (to
+	detect double and trailing spaces), the start of range comments, control characters including
+	new lines and the null terminator, and apostrophes, whose positions are recorded for emitters.
+	UTF-8 bytes are copied as they are, since the source has already been validated and columns are
+	only counted when reporting errors.
+*/
+static bool is_special_text_char(char c)
+{
+	const uint8_t b = c;
+	return
+		b <= ' ' ||
+		b == 127 ||
+		b == '\\' ||
+		b == '\'' ||
+		b == '"' ||
+		b == '[' ||
+		b == '*' ||
+		b == '-' ||
+		b == '/';
+}
+
+#if defined(SIMD_AVX2)
+
+static uint32_t get_special_text_mask(const char* block)
+{
+	const __m256i v = _mm256_load_si256((const __m256i*)block);
+
+	// Control characters and spaces are the bytes left unchanged by an unsigned minimum with ' '
+	__m256i special = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(' ')), v);
+	special = _mm256_or_si256(special, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(127)));
+	special = _mm256_or_si256(special, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+	special = _mm256_or_si256(special, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+	special = _mm256_or_si256(special, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+	special = _mm256_or_si256(special, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')));
+	special = _mm256_or_si256(special, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')));
+	special = _mm256_or_si256(special, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')));
+	special = _mm256_or_si256(special, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+
+	return (uint32_t)_mm256_movemask_epi8(special);
+}
+
+static uint32_t get_source_break_mask(const char* block)
+{
+	const __m256i v = _mm256_load_si256((const __m256i*)block);
+
+	__m256i found = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+	found = _mm256_or_si256(found, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+	found = _mm256_or_si256(found, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+
+	return (uint32_t)_mm256_movemask_epi8(found);
+}
+
+static uint32_t count_newline_blocks(const char* block, uint32_t block_count)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	uint32_t count = 0;
+
+	while (block_count)
+	{
+		// Each byte lane can count 255 matches before it overflows and has to be summed
+		const uint32_t batch = block_count < 255 ? block_count : 255;
+		block_count -= batch;
+
+		__m256i counters = _mm256_setzero_si256();
+		for (uint32_t i = 0; i < batch; ++i, block += 32)
+		{
+			// Matches are all ones, so subtracting them adds one per new line
+			const __m256i v = _mm256_load_si256((const __m256i*)block);
+			counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(v, newline));
+		}
+
+		const __m256i sums = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+		const __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+		count += (uint32_t)_mm_cvtsi128_si32(sum) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+	}
+
+	return count;
+}
+
+/*
+	Errors that a pair of adjacent bytes can be part of, for the lookup table UTF-8 check. Each table
+	maps one nibble of the pair to the errors it is consistent with, so the pair is only invalid
+	when all three tables agree. Overlong four byte encodings share a bit with the first byte of
+	code points above U+10FFFF, since the same nibbles select them.
+*/
+enum
+{
+	utf8_error_too_short	= 1 << 0,	// Lead byte followed by ASCII or another lead byte
+	utf8_error_too_long		= 1 << 1,	// ASCII followed by a continuation byte
+	utf8_error_overlong_3	= 1 << 2,	// 0xE0 followed by 0x80 to 0x9F
+	utf8_error_too_large	= 1 << 3,	// 0xF4 followed by 0x90 or more, or a lead above 0xF4
+	utf8_error_surrogate	= 1 << 4,	// 0xED followed by 0xA0 or more
+	utf8_error_overlong_2	= 1 << 5,	// 0xC0 or 0xC1
+	utf8_error_too_large_80	= 1 << 6,	// Lead above 0xF4 followed by 0x80 to 0x8F
+	utf8_error_overlong_4	= 1 << 6,	// 0xF0 followed by 0x80 to 0x8F
+	utf8_error_two_conts	= 1 << 7,	// Continuation followed by a continuation, unless a lead needs it
+
+	// Errors that don't depend on the low nibble of the first byte
+	utf8_error_carry		= utf8_error_too_short | utf8_error_too_long | utf8_error_two_conts
+};
+
+static const uint8_t utf8_first_high_errors[16] = {
+	// ASCII
+	utf8_error_too_long, utf8_error_too_long, utf8_error_too_long, utf8_error_too_long,
+	utf8_error_too_long, utf8_error_too_long, utf8_error_too_long, utf8_error_too_long,
+	// Continuation
+	utf8_error_two_conts, utf8_error_two_conts, utf8_error_two_conts, utf8_error_two_conts,
+	// Two, three and four byte leads
+	utf8_error_too_short | utf8_error_overlong_2,
+	utf8_error_too_short,
+	utf8_error_too_short | utf8_error_overlong_3 | utf8_error_surrogate,
+	utf8_error_too_short | utf8_error_too_large | utf8_error_too_large_80 | utf8_error_overlong_4
+};
+
+static const uint8_t utf8_first_low_errors[16] = {
+	utf8_error_carry | utf8_error_overlong_3 | utf8_error_overlong_2 | utf8_error_overlong_4,
+	utf8_error_carry | utf8_error_overlong_2,
+	utf8_error_carry,
+	utf8_error_carry,
+	utf8_error_carry | utf8_error_too_large,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80 | utf8_error_surrogate,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80,
+	utf8_error_carry | utf8_error_too_large | utf8_error_too_large_80
+};
+
+static const uint8_t utf8_second_high_errors[16] = {
+	// ASCII
+	utf8_error_too_short, utf8_error_too_short, utf8_error_too_short, utf8_error_too_short,
+	utf8_error_too_short, utf8_error_too_short, utf8_error_too_short, utf8_error_too_short,
+	// Continuation: 0x80 to 0x8F, 0x90 to 0x9F, then 0xA0 to 0xBF
+	utf8_error_too_long | utf8_error_overlong_2 | utf8_error_two_conts | utf8_error_overlong_3 | utf8_error_too_large_80 | utf8_error_overlong_4,
+	utf8_error_too_long | utf8_error_overlong_2 | utf8_error_two_conts | utf8_error_overlong_3 | utf8_error_too_large,
+	utf8_error_too_long | utf8_error_overlong_2 | utf8_error_two_conts | utf8_error_surrogate | utf8_error_too_large,
+	utf8_error_too_long | utf8_error_overlong_2 | utf8_error_two_conts | utf8_error_surrogate | utf8_error_too_large,
+	// Lead bytes
+	utf8_error_too_short, utf8_error_too_short, utf8_error_too_short, utf8_error_too_short
+};
+
+// Subtracting these leaves a non-zero byte where a sequence is still incomplete at the end of a block
+static const uint8_t utf8_incomplete_limits[32] = {
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+static __m256i lookup_utf8_errors(const uint8_t* table, __m256i nibbles)
+{
+	const __m256i lookup = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)table));
+	return _mm256_shuffle_epi8(lookup, nibbles);
+}
+
+/*
+	Returns a non-zero byte for every byte of v that ends an invalid sequence, given the block that
+	came before it. Sequences still incomplete at the end of v are found with the next block.
+*/
+static __m256i get_utf8_block_errors(__m256i v, __m256i previous)
+{
+	// Shift in the end of the previous block, so each byte lines up with the three before it
+	const __m256i carried = _mm256_permute2x128_si256(previous, v, 0x21);
+	const __m256i previous_1 = _mm256_alignr_epi8(v, carried, 15);
+	const __m256i previous_2 = _mm256_alignr_epi8(v, carried, 14);
+	const __m256i previous_3 = _mm256_alignr_epi8(v, carried, 13);
+
+	const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+	const __m256i first_high = lookup_utf8_errors(utf8_first_high_errors, _mm256_and_si256(_mm256_srli_epi16(previous_1, 4), low_nibble));
+	const __m256i first_low = lookup_utf8_errors(utf8_first_low_errors, _mm256_and_si256(previous_1, low_nibble));
+	const __m256i second_high = lookup_utf8_errors(utf8_second_high_errors, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble));
+	const __m256i errors = _mm256_and_si256(_mm256_and_si256(first_high, first_low), second_high);
+
+	// The third and fourth bytes of longer sequences must be continuations, which cancels two_conts
+	const __m256i is_third = _mm256_subs_epu8(previous_2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+	const __m256i is_fourth = _mm256_subs_epu8(previous_3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+	const __m256i must_continue = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8((char)0x80));
+
+	return _mm256_xor_si256(errors, must_continue);
+}
+
+enum { scan_block_size = 32 };
+
+#elif defined(SIMD_SSE2)
+
+static uint32_t get_special_text_mask(const char* block)
+{
+	const __m128i v = _mm_load_si128((const __m128i*)block);
+
+	// Control characters and spaces are the bytes left unchanged by an unsigned minimum with ' '
+	__m128i special = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(' ')), v);
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8(127)));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+
+	return (uint32_t)_mm_movemask_epi8(special);
+}
+
+static uint32_t get_source_break_mask(const char* block)
+{
+	const __m128i v = _mm_load_si128((const __m128i*)block);
+
+	__m128i found = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+
+	return (uint32_t)_mm_movemask_epi8(found);
+}
+
+static uint32_t count_newline_blocks(const char* block, uint32_t block_count)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	uint32_t count = 0;
+
+	while (block_count)
+	{
+		// Each byte lane can count 255 matches before it overflows and has to be summed
+		const uint32_t batch = block_count < 255 ? block_count : 255;
+		block_count -= batch;
+
+		__m128i counters = _mm_setzero_si128();
+		for (uint32_t i = 0; i < batch; ++i, block += 16)
+		{
+			// Matches are all ones, so subtracting them adds one per new line
+			const __m128i v = _mm_load_si128((const __m128i*)block);
+			counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(v, newline));
+		}
+
+		const __m128i sum = _mm_sad_epu8(counters, _mm_setzero_si128());
+		count += (uint32_t)_mm_cvtsi128_si32(sum) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+	}
+
+	return count;
+}
+
+enum { scan_block_size = 16 };
+
+#endif
+
+// Returns a pointer to the first special text character at or after text
+static const char* scan_plain_text(const char* text)
+{
+#if defined(SIMD_AVX2) || defined(SIMD_SSE2)
+	const uintptr_t misalignment = (uintptr_t)text & (scan_block_size - 1);
+	const char* block = text - misalignment;
+
+	// Ignore matches before the start of the text in the first block
+	uint32_t mask = get_special_text_mask(block) & (UINT32_MAX << misalignment);
+	while (!mask)
+	{
+		block += scan_block_size;
+		mask = get_special_text_mask(block);
+	}
+
+	return block + count_trailing_zeros(mask);
+#else
+	while (!is_special_text_char(*text))
+		++text;
+
+	return text;
+#endif
+}
+
+/*
+	Returns a pointer to the first carriage return, slash or null character at or after text. These
+	are the only characters that normalising the source may need to remove.
+*/
+static const char* scan_source_breaks(const char* text)
+{
+#if defined(SIMD_AVX2) || defined(SIMD_SSE2)
+	const uintptr_t misalignment = (uintptr_t)text & (scan_block_size - 1);
+	const char* block = text - misalignment;
+
+	// Ignore matches before the start of the text in the first block
+	uint32_t mask = get_source_break_mask(block) & (UINT32_MAX << misalignment);
+	while (!mask)
+	{
+		block += scan_block_size;
+		mask = get_source_break_mask(block);
+	}
+
+	return block + count_trailing_zeros(mask);
+#else
+	while (*text && *text != '\r' && *text != '/')
+		++text;
+
+	return text;
+#endif
+}
+
+/*
+	Counts the new line characters in size bytes of text. Every source line produces at most one
+	line token, so this gives the tokeniser an upper bound to size its token array up front.
+*/
+static uint32_t count_newlines(const char* text, uint32_t size)
+{
+	const char* end = text + size;
+	uint32_t count = 0;
+
+#if defined(SIMD_AVX2) || defined(SIMD_SSE2)
+	// Count bytes singly up to the first aligned block, then whole blocks, then the remainder
+	while (text < end && ((uintptr_t)text & (scan_block_size - 1)))
+		count += *text++ == '\n';
+
+	const uint32_t block_count = (uint32_t)(end - text) / scan_block_size;
+	count += count_newline_blocks(text, block_count);
+	text += block_count * scan_block_size;
+#endif
+
+	while (text < end)
+		count += *text++ == '\n';
+
+	return count;
+}
+
+/*
+	Returns the length of the UTF-8 sequence at text, or zero if it's invalid. Overlong encodings,
+	surrogates and code points above U+10FFFF are all invalid, as are sequences cut short by the end.
+*/
+static uint32_t get_utf8_sequence_length(const uint8_t* text, uint32_t remaining)
+{
+	const uint8_t b = text[0];
+	if (b < 0x80)
+		return 1;
+
+	// Only the second byte has a range that depends on the lead byte
+	uint8_t low = 0x80;
+	uint8_t high = 0xBF;
+	uint32_t length;
+	if (b >= 0xC2 && b <= 0xDF)
+	{
+		length = 2;
+	}
+	else if (b >= 0xE0 && b <= 0xEF)
+	{
+		length = 3;
+		if (b == 0xE0)
+			low = 0xA0;
+		else if (b == 0xED)
+			high = 0x9F;
+	}
+	else if (b >= 0xF0 && b <= 0xF4)
+	{
+		length = 4;
+		if (b == 0xF0)
+			low = 0x90;
+		else if (b == 0xF4)
+			high = 0x8F;
+	}
+	else
+	{
+		return 0;
+	}
+
+	if (remaining < length || text[1] < low || text[1] > high)
+		return 0;
+
+	for (uint32_t i = 2; i < length; ++i)
+	{
+		if ((text[i] & 0xC0) != 0x80)
+			return 0;
+	}
+
+	return length;
+}
+
+/*
+	Returns the offset of the first invalid UTF-8 sequence in size bytes of text, or size if it's all
+	valid. The SIMD paths find which block holds the first error, and then the exact offset is found
+	a sequence at a time.
+*/
+static uint32_t find_invalid_utf8(const char* text, uint32_t size)
+{
+	const uint8_t* data = (const uint8_t*)text;
+	uint32_t offset = 0;
+
+#if defined(SIMD_AVX2)
+	__m256i previous = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+
+	// The last block is padded with null characters, which end any incomplete sequence
+	uint8_t last_block[scan_block_size] = {};
+
+	for (;;)
+	{
+		const bool is_last = size - offset < scan_block_size;
+		const uint8_t* block = data + offset;
+		if (is_last)
+		{
+			memcpy(last_block, block, size - offset);
+			block = last_block;
+		}
+
+		const __m256i v = _mm256_loadu_si256((const __m256i*)block);
+
+		__m256i errors;
+		if (!_mm256_movemask_epi8(v))
+		{
+			// ASCII is always valid, as long as the previous block didn't end partway through a sequence
+			errors = incomplete;
+			incomplete = _mm256_setzero_si256();
+		}
+		else
+		{
+			errors = get_utf8_block_errors(v, previous);
+			incomplete = _mm256_subs_epu8(v, _mm256_loadu_si256((const __m256i*)utf8_incomplete_limits));
+		}
+
+		if (!_mm256_testz_si256(errors, errors))
+			break;
+
+		if (is_last)
+			return size;
+
+		previous = v;
+		offset += scan_block_size;
+	}
+
+	// Everything before this block is valid, so restart from the lead byte of a sequence it cuts
+	for (uint32_t back = 1; back <= 3 && back <= offset; ++back)
+	{
+		if ((data[offset - back] & 0xC0) != 0x80)
+		{
+			offset -= back;
+			break;
+		}
+	}
+#elif defined(SIMD_SSE2)
+	// Whole blocks of ASCII are skipped, and other blocks are checked a sequence at a time
+	while (size - offset >= scan_block_size)
+	{
+		if (!_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(data + offset))))
+		{
+			offset += scan_block_size;
+			continue;
+		}
+
+		const uint32_t block_end = offset + scan_block_size;
+		while (offset < block_end)
+		{
+			const uint32_t length = get_utf8_sequence_length(data + offset, size - offset);
+			if (!length)
+				return offset;
+
+			offset += length;
+		}
+	}
+#endif
+
+	while (offset < size)
+	{
+		const uint32_t length = get_utf8_sequence_length(data + offset, size - offset);
+		if (!length)
+			return offset;
+
+		offset += length;
+	}
+
+	return size;
+}
@@ -5,132 +5,199 @@ typedef enum
 	emphasis_state_emphasis
 } emphasis_state;
 
-static void handle_peek_error(const peek_state* peek, const char* format, ...)
+typedef enum
 {
-	fprintf(stderr, "Parsing error (line %u, column %u): ", peek->line, peek->column);
+	char_class_continuation,	// Byte in the middle of a UTF-8 code point, which doesn't advance the column
+	char_class_column,			// Printable ASCII or the first byte of a UTF-8 code point
+	char_class_null,
+	char_class_tab,
+	char_class_carriage_return,
+	char_class_new_line,
+	char_class_invalid
+} char_class;
 
-	va_list args;
-	va_start(args, format);
-	vfprintf(stderr, format, args);
-	va_end(args);
+/*
+	Class of every byte, which lets peek_char_internal pass over most bytes after a single check.
+	The first two classes are also the number of columns the byte advances.
+*/
+static const uint8_t char_classes[256] = {
+	2, 6, 6, 6, 6, 6, 6, 6, 6, 3, 5, 6, 6, 4, 6, 6,	// 0x00
+	6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,	// 0x10
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 0x20
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 0x30
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 0x40
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 0x50
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 0x60
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 6,	// 0x70
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	// 0x80
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	// 0x90
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	// 0xA0
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	// 0xB0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 0xC0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 0xD0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 0xE0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1	// 0xF0
+};
+
+// Works out the line and column of c, where tabs advance to the next multiple of four columns
+static void get_source_position(const char* source, const char* c, uint32_t* out_line, uint32_t* out_column)
+{
+	const char* line_start = c;
+	while (line_start > source && line_start[-1] != '\n')
+		--line_start;
 
-	fputc('\n', stderr);
+	// UTF-8 continuation bytes and null characters don't advance the column, other controls count as one
+	uint32_t column = 1;
+	for (const char* p = line_start; p < c; ++p)
+	{
+		const char_class type = char_classes[(uint8_t)*p];
+		if (type == char_class_tab)
+			column += 4 - ((column - 1) % 4);
+		else if (type <= char_class_column)
+			column += type;
+		else if (type != char_class_null)
+			++column;
+	}
 
-	assert(false);
-	exit(EXIT_FAILURE);
+	*out_line = count_newlines(source, (uint32_t)(c - source)) + 1;
+	*out_column = column;
+}
+
+/*
+	Only the read pointer and a line counter are tracked while tokenising, since positions are
+	rarely needed. When an error is reported, the last character read is mapped back to the original
+	source, and its line and column are worked out again from there.
+*/
+static void get_peek_position(const tokenise_context* ctx, const peek_state* peek, uint32_t* out_line, uint32_t* out_column)
+{
+	const source_text* text = ctx->source;
+	assert(peek->read_ptr > text->text);
+
+	const uint32_t offset = (uint32_t)(peek->read_ptr - 1 - text->text);
+	const uint32_t index = count_source_offsets(text->offsets, text->offset_count, offset);
+	const uint32_t removed = index ? text->offsets[index - 1].removed : 0;
+
+	const char* source = text->original;
+	const char* c = source + offset + removed;
+
+	// "\r\n" is read as a single new line, which starts at the '\r'
+	if (*c == '\n' && c > source && c[-1] == '\r')
+		--c;
+
+	get_source_position(source, c, out_line, out_column);
+}
+
+static void handle_peek_error(const tokenise_context* ctx, const peek_state* peek, const char* format, ...)
+{
+	uint32_t line, column;
+	get_peek_position(ctx, peek, &line, &column);
+
+	char prefix[64];
+	snprintf(prefix, sizeof(prefix), "Parsing error (line %u, column %u): ", line, column);
+
+	va_list args;
+	va_start(args, format);
+	report_error(prefix, format, args);
 }
 
 static void handle_tokenise_error(const tokenise_context* ctx, const char* format, ...)
 {
-	fprintf(stderr, "Parsing error (line %u, column %u): ", ctx->peek.line, ctx->peek.column);
+	uint32_t line, column;
+	get_peek_position(ctx, &ctx->peek, &line, &column);
+
+	char prefix[64];
+	snprintf(prefix, sizeof(prefix), "Parsing error (line %u, column %u): ", line, column);
 
 	va_list args;
 	va_start(args, format);
-	vfprintf(stderr, format, args);
-	va_end(args);
+	report_error(prefix, format, args);
+}
+
+static void handle_source_error(const char* source, uint32_t offset, const char* format, ...)
+{
+	uint32_t line, column;
+	get_source_position(source, source + offset, &line, &column);
 
-	fputc('\n', stderr);
+	char prefix[64];
+	snprintf(prefix, sizeof(prefix), "Parsing error (line %u, column %u): ", line, column);
 
-	assert(false);
-	exit(EXIT_FAILURE);
+	va_list args;
+	va_start(args, format);
+	report_error(prefix, format, args);
 }
 
-static line_token* add_line_token(tokenise_context* ctx, line_token_type type)
+static void allocate_line_tokens(tokenise_context* ctx, uint32_t capacity)
 {
-	line_token* line;
+	line_tokens* tokens = &ctx->tokens;
+	const uint32_t old_capacity = ctx->token_capacity;
 
-	if (ctx->line_count == ctx->line_capacity)
-	{
-		const uint32_t elements_per_page = page_size / sizeof(line_token);
-		const uint32_t current_size = ctx->line_capacity ? ctx->line_capacity / elements_per_page : page_size;
-		const uint32_t next_size = current_size + page_size;
+	tokens->types = arena_grow(ctx->memory, tokens->types, old_capacity, capacity);
+	tokens->span_indices = arena_grow(ctx->memory, tokens->span_indices, sizeof(uint32_t) * old_capacity, sizeof(uint32_t) * capacity);
+	tokens->lines = arena_grow(ctx->memory, tokens->lines, sizeof(uint32_t) * old_capacity, sizeof(uint32_t) * capacity);
+	tokens->indices = arena_grow(ctx->memory, tokens->indices, sizeof(uint32_t) * old_capacity, sizeof(uint32_t) * capacity);
 
-		ctx->lines = realloc(ctx->lines, next_size);
-		ctx->line_capacity += elements_per_page;
-	}
+	// Every token has at most one span of text
+	tokens->spans = arena_grow(ctx->memory, tokens->spans, sizeof(text_span) * old_capacity, sizeof(text_span) * capacity);
 
-	line = &ctx->lines[ctx->line_count++];
-	line->type = type;
-	line->line = ctx->peek.line;
-	line->text = ctx->write_ptr;
+	ctx->token_capacity = capacity;
+}
 
-#ifndef NDEBUG
-	// Make it easier to read tokens in the watch window
-	if (type == line_token_type_newline || type == line_token_type_eof)
-		line->text = nullptr;
-#endif
+// Line of the last character read, which is one before the counter if it was a new line
+static uint32_t get_line(tokenise_context* ctx)
+{
+	const peek_state* peek = &ctx->peek;
+	const source_text* source = ctx->source;
 
-	ctx->current_line = line;
+	// New lines inside removed range comments still count, and tokens are added in source order
+	const uint32_t offset = (uint32_t)(peek->read_ptr - 1 - source->text);
+	while (ctx->line_offset_index < source->line_offset_count && source->line_offsets[ctx->line_offset_index].offset <= offset)
+		ctx->removed_lines = source->line_offsets[ctx->line_offset_index++].removed;
 
-	return line;
+	return peek->next_line - (peek->c == '\n') + ctx->removed_lines;
+}
+
+// Returns the index of the new token
+static uint32_t add_line_token(tokenise_context* ctx, line_token_type type)
+{
+	// The arrays are sized from the new line count, so this only runs if that estimate was short
+	if (ctx->tokens.count == ctx->token_capacity)
+		allocate_line_tokens(ctx, ctx->token_capacity * 2);
+
+	const uint32_t index = ctx->tokens.count++;
+	ctx->tokens.types[index] = (uint8_t)type;
+	ctx->tokens.span_indices[index] = 0;
+	ctx->tokens.lines[index] = get_line(ctx);
+	ctx->tokens.indices[index] = 0;
+
+	return index;
 }
 
 static char peek_char_internal(tokenise_context* ctx, peek_state* peek)
 {
 	char c = *peek->read_ptr++;
 
-	peek->prev_line = peek->line;
-	peek->prev_column = peek->column;
-	peek->line = peek->next_line;
-	peek->column = peek->next_column;
+	const char_class type = char_classes[(uint8_t)c];
+	if (type <= char_class_column)
+		return c;
 
-	if (c & 0b10000000) // UTF-8 code point with multiple bytes
-	{
-		if (!(c & 0b01000000))
-		{
-			// Ignore bytes in the middle of a UTF-8 code point
-		}
-		else
-		{
-			// First byte, so increment position
-			++peek->next_column;
-		}
-	}
-	else // ASCII
+	switch (type)
 	{
-		if (c < 32)
-		{
-			if (c == 0)
-			{
-				return 0;
-			}
-			else if (c == '\t')
-			{
-				const uint32_t tab_size = 4 - ((peek->next_column - 1) % 4);
-				peek->next_column += tab_size;
-			}
-			else if (c == '\r')
-			{
-				if (*peek->read_ptr == '\n')
-				{
-					c = *peek->read_ptr++;
-
-					++peek->next_line;
-					peek->next_column = 1;
-				}
-				else
-				{
-					handle_tokenise_error(ctx, "Unsupported control character; this error may be caused by file corruption or attempting to load a binary file.");
-				}
-			}
-			else if (c == '\n')
-			{
-				++peek->next_line;
-				peek->next_column = 1;
-			}
-			else
-			{
-				handle_tokenise_error(ctx, "Unsupported control character; this error may be caused by file corruption or attempting to load a binary file.");
-			}
-		}
-		else if (c == 127)
-		{
+	case char_class_null:
+		return 0;
+	case char_class_tab:
+		break;
+	case char_class_carriage_return:
+		if (*peek->read_ptr != '\n')
 			handle_tokenise_error(ctx, "Unsupported control character; this error may be caused by file corruption or attempting to load a binary file.");
-		}
-		else
-		{
-			++peek->next_column;
-		}
+
+		// Collapse "\r\n" into a single new line
+		c = *peek->read_ptr++;
+		// Fall through
+	case char_class_new_line:
+		++peek->next_line;
+		break;
+	default:
+		handle_tokenise_error(ctx, "Unsupported control character; this error may be caused by file corruption or attempting to load a binary file.");
 	}
 
 	return c;
@@ -145,8 +212,9 @@ static char peek_char(tokenise_context* ctx, peek_state* peek)
 {
 	peek->pc = peek->c;
 
+	// Comments are normally removed before tokenising, unless one would cause an error
 	char c = peek_char_internal(ctx, peek);
-	if (c == '/' && *peek->read_ptr == '*')
+	if (c == '/' && ctx->source->has_comments && *peek->read_ptr == '*')
 	{
 		// Consume '*'
 		c = peek_char_internal(ctx, peek);
@@ -202,11 +270,54 @@ static void put_char(tokenise_context* ctx, char c)
 	*ctx->write_ptr++ = c;
 }
 
+// Records the position of the next character written as one that emitters must handle
+static void add_text_control(tokenise_context* ctx)
+{
+	line_tokens* tokens = &ctx->tokens;
+
+	if (tokens->control_count == ctx->control_capacity)
+	{
+		const uint32_t next_capacity = ctx->control_capacity * 2;
+		tokens->controls = arena_grow(ctx->memory, tokens->controls, sizeof(uint32_t) * ctx->control_capacity, sizeof(uint32_t) * next_capacity);
+		ctx->control_capacity = next_capacity;
+	}
+
+	text_span* span = &tokens->spans[tokens->span_count - 1];
+	tokens->controls[tokens->control_count++] = (uint32_t)(ctx->write_ptr - ctx->buffer) - span->offset;
+	++span->control_count;
+}
+
 static void put_text_token(tokenise_context* ctx, text_token_type token)
 {
+	add_text_control(ctx);
 	*ctx->write_ptr++ = token;
 }
 
+/*
+	Most characters in a paragraph need no special handling, so rather than reading them one at a
+	time with get_char(), find the next special character and copy the run up to it in bulk. The peek
+	state is left exactly as if each character had been read individually.
+*/
+static void put_plain_text(tokenise_context* ctx)
+{
+	peek_state* peek = &ctx->peek;
+
+	const char* start = peek->read_ptr;
+	const char* end = scan_plain_text(start);
+	const uint32_t len = (uint32_t)(end - start);
+
+	if (!len)
+		return;
+
+	memcpy(ctx->write_ptr, start, len);
+	ctx->write_ptr += len;
+
+	// Runs never contain new lines, so only the read pointer and previous characters change
+	peek->read_ptr = end;
+	peek->pc = len > 1 ? end[-2] : peek->c;
+	peek->c = end[-1];
+}
+
 static uint32_t arabic_to_int(const char* str, char terminator)
 {
 	uint32_t digits[10];
@@ -327,7 +438,7 @@ static bool check_emphasis(tokenise_context* ctx, char c, emphasis_state* state)
 			peek_apply(ctx, &peek);
 
 			if (peek_char(ctx, &peek) == '*')
-				handle_peek_error(&peek, "Only two levels of '*' allowed.");
+				handle_peek_error(ctx, &peek, "Only two levels of '*' allowed.");
 
 			if (*state == emphasis_state_none)
 			{
@@ -341,7 +452,7 @@ static bool check_emphasis(tokenise_context* ctx, char c, emphasis_state* state)
 			}
 			else
 			{
-				handle_peek_error(&peek, "Emphasis tags '*' cannot be mixed with strong tags \"**\".");
+				handle_peek_error(ctx, &peek, "Emphasis tags '*' cannot be mixed with strong tags \"**\".");
 			}
 		}
 		else
@@ -358,7 +469,7 @@ static bool check_emphasis(tokenise_context* ctx, char c, emphasis_state* state)
 			}
 			else
 			{
-				handle_peek_error(&peek, "Emphasis tags '*' cannot be mixed with strong tags \"**\".");
+				handle_peek_error(ctx, &peek, "Emphasis tags '*' cannot be mixed with strong tags \"**\".");
 			}
 		}
 
@@ -381,7 +492,7 @@ static bool check_dash(tokenise_context* ctx, char c)
 			put_text_token(ctx, text_token_type_em_dash);
 
 			if (peek_char(ctx, &peek) == '-')
-				handle_peek_error(&peek, "Too many hyphens.");
+				handle_peek_error(ctx, &peek, "Too many hyphens.");
 		}
 		else
 		{
@@ -403,7 +514,7 @@ static bool check_newline(tokenise_context* ctx, char c)
 		put_char(ctx, 0);
 
 		if (ctx->peek.pc == ' ')
-			handle_peek_error(&ctx->peek, "Trailing spaces are not permitted.");
+			handle_peek_error(ctx, &ctx->peek, "Trailing spaces are not permitted.");
 
 		return true;
 	}
@@ -416,6 +527,16 @@ static char tokenise_text(tokenise_context* ctx, char c)
 	if (c == ' ')
 		handle_tokenise_error(ctx, "Leading spaces are not permitted.");
 
+	// The text belongs to the line token that was just added
+	line_tokens* tokens = &ctx->tokens;
+	tokens->span_indices[tokens->count - 1] = tokens->span_count;
+
+	text_span* span = &tokens->spans[tokens->span_count++];
+	*span = (text_span){
+		.offset			= (uint32_t)(ctx->write_ptr - ctx->buffer),
+		.first_control	= tokens->control_count
+	};
+
 	int quote_level = 0;
 	emphasis_state em_state = emphasis_state_none;
 
@@ -470,12 +591,20 @@ static char tokenise_text(tokenise_context* ctx, char c)
 		}
 		else
 		{
+			// Control characters are passed through, and apostrophes are made typographic
+			if ((uint8_t)c < ' ' || c == '\'')
+				add_text_control(ctx);
+
 			put_char(ctx, c);
+			put_plain_text(ctx);
 		}
 
 		c = get_char(ctx);
 	}
 
+	// Exclude the null terminator
+	span->length = (uint32_t)(ctx->write_ptr - ctx->buffer) - span->offset - 1;
+
 	if (quote_level != 0)
 		handle_tokenise_error(ctx, "Unterminated quote.");
 
@@ -546,8 +675,8 @@ static char tokenise_ordered_list_arabic(tokenise_context* ctx, char c)
 		peeked_char = peek_char(ctx, &peek);
 		if (peeked_char == ' ')
 		{
-			line_token* line = add_line_token(ctx, line_token_type_ordered_list_arabic);
-			line->index = arabic_to_int_new(ctx, &ctx->peek, c, '.');
+			const uint32_t token = add_line_token(ctx, line_token_type_ordered_list_arabic);
+			ctx->tokens.indices[token] = arabic_to_int_new(ctx, &ctx->peek, c, '.');
 			peek_apply(ctx, &peek);
 
 			return tokenise_text(ctx, get_char(ctx));
@@ -579,8 +708,8 @@ static char tokenise_ordered_list_roman(tokenise_context* ctx, char c)
 		peeked_char = peek_char(ctx, &peek);
 		if (peeked_char == ' ')
 		{
-			line_token* line = add_line_token(ctx, line_token_type_ordered_list_roman);
-			line->index = roman_to_int(ctx, &ctx->peek, c, len);
+			const uint32_t token = add_line_token(ctx, line_token_type_ordered_list_roman);
+			ctx->tokens.indices[token] = roman_to_int(ctx, &ctx->peek, c, len);
 			peek_apply(ctx, &peek);
 
 			return tokenise_text(ctx, get_char(ctx));
@@ -599,8 +728,8 @@ static char tokenise_ordered_list_letter(tokenise_context* ctx, char c, bool blo
 	{
 		peek_apply(ctx, &peek);
 
-		line_token* line = add_line_token(ctx, line_token_type_ordered_list_letter);
-		line->index = c - 'a' + 1;
+		const uint32_t token = add_line_token(ctx, line_token_type_ordered_list_letter);
+		ctx->tokens.indices[token] = c - 'a' + 1;
 
 		return tokenise_text(ctx, get_char(ctx));
 	}
@@ -673,8 +802,8 @@ static char tokenise_bracket(tokenise_context* ctx, char c)
 	{
 		const uint32_t index = arabic_to_int_new(ctx, &ctx->peek, c, ']');
 
-		line_token* line = add_line_token(ctx, line_token_type_reference);
-		line->index = index;
+		const uint32_t token = add_line_token(ctx, line_token_type_reference);
+		ctx->tokens.indices[token] = index;
 
 		c = get_char(ctx);
 		if (c != ' ')
@@ -718,59 +847,413 @@ static char tokenise_comment(tokenise_context* ctx, char c)
 	return tokenise_paragraph(ctx, c, false);
 }
 
-static void tokenise(char* data, line_tokens* out_tokens, document_metadata* metadata)
+static void init_tokenise_context(tokenise_context* ctx, const source_text* source, uint32_t offset, uint32_t size, char* buffer, char* write_ptr, arena* memory, document_metadata* metadata)
 {
-	tokenise_context ctx = {
-		.buffer				= data,
-		.write_ptr			= data,
+	const char* data = source->text + offset;
+
+	*ctx = (tokenise_context){
+		.source				= source,
+		.buffer				= buffer,
+		.write_ptr			= write_ptr,
+		.tokens				= {
+			.text			= buffer
+		},
 		.peek				= {
 			.read_ptr		= data,
-			.next_line		= 1,
-			.next_column	= 1
+			.next_line		= 1
 		},
-		.metadata			= metadata
+		.metadata			= metadata,
+		.memory				= memory
 	};
 
+	// New lines in comments removed before the start still count towards line numbers
+	const uint32_t index = count_source_offsets(source->line_offsets, source->line_offset_count, offset);
+	ctx->line_offset_index = index;
+	ctx->removed_lines = index ? source->line_offsets[index - 1].removed : 0;
+
+	// One token per line, plus a possible unterminated last line and the final new line and end
+	allocate_line_tokens(ctx, count_newlines(data, size) + 3);
+
+	// Rough guess at how many dashes, quotes and other control characters the text holds
+	ctx->control_capacity = size / 32 + 16;
+	ctx->tokens.controls = arena_alloc(memory, sizeof(uint32_t) * ctx->control_capacity);
+}
+
+typedef enum
+{
+	line_class_paragraph,
+	line_class_end,
+	line_class_comment,
+	line_class_bracket,
+	line_class_blockquote,
+	line_class_new_line,
+	line_class_heading,
+	line_class_unordered_list,
+	line_class_ordered_list_arabic,
+	line_class_ordered_list_letter,
+	line_class_ordered_list_roman
+} line_class;
+
+// Which tokenisation function handles a line, given its first character
+static const uint8_t line_classes[256] = {
+	[0]		= line_class_end,
+	['/']	= line_class_comment,
+	['[']	= line_class_bracket,
+	['\t']	= line_class_blockquote,
+	['\n']	= line_class_new_line,
+	['#']	= line_class_heading,
+	['*']	= line_class_unordered_list,
+	['1']	= line_class_ordered_list_arabic,
+	['2']	= line_class_ordered_list_arabic,
+	['3']	= line_class_ordered_list_arabic,
+	['4']	= line_class_ordered_list_arabic,
+	['5']	= line_class_ordered_list_arabic,
+	['6']	= line_class_ordered_list_arabic,
+	['7']	= line_class_ordered_list_arabic,
+	['8']	= line_class_ordered_list_arabic,
+	['9']	= line_class_ordered_list_arabic,
+	['a']	= line_class_ordered_list_letter,
+	['b']	= line_class_ordered_list_letter,
+	['c']	= line_class_ordered_list_letter,
+	['d']	= line_class_ordered_list_letter,
+	['e']	= line_class_ordered_list_letter,
+	['f']	= line_class_ordered_list_letter,
+	['g']	= line_class_ordered_list_letter,
+	['h']	= line_class_ordered_list_letter,
+	['i']	= line_class_ordered_list_letter,
+	['j']	= line_class_ordered_list_letter,
+	['k']	= line_class_ordered_list_letter,
+	['l']	= line_class_ordered_list_letter,
+	['m']	= line_class_ordered_list_letter,
+	['n']	= line_class_ordered_list_letter,
+	['o']	= line_class_ordered_list_letter,
+	['p']	= line_class_ordered_list_letter,
+	['q']	= line_class_ordered_list_letter,
+	['r']	= line_class_ordered_list_letter,
+	['s']	= line_class_ordered_list_letter,
+	['t']	= line_class_ordered_list_letter,
+	['u']	= line_class_ordered_list_letter,
+	['v']	= line_class_ordered_list_letter,
+	['w']	= line_class_ordered_list_letter,
+	['x']	= line_class_ordered_list_letter,
+	['y']	= line_class_ordered_list_letter,
+	['z']	= line_class_ordered_list_letter,
+	['I']	= line_class_ordered_list_roman,
+	['V']	= line_class_ordered_list_roman,
+	['X']	= line_class_ordered_list_roman
+};
+
+// Returns the character that ended tokenisation, which is 0 at the end of the file
+static char tokenise_lines(tokenise_context* ctx, const char* end)
+{
 	/*
 		This loop checks the first character of each line and delegates parsing to specialised
 		tokenisation functions. Sometimes the first character may be a false positive, in which case
 		tokenisation is delegated to the more appropriate function. For example, a line starting
 		with "1. " represents a list item, whereas "1 apple" would represent a paragraph.
 	*/
-	char c = get_char(&ctx);
-	for (;;)
+	char c = get_char(ctx);
+
+	// A chunk stops once it reads the first character of the next chunk
+	while (ctx->peek.read_ptr <= end)
 	{
-		if (c == 0)
+		switch (line_classes[(uint8_t)c])
+		{
+		case line_class_end:
+			return c;
+		case line_class_comment:
+			c = tokenise_comment(ctx, c);
 			break;
-		else if (c == '/')
-			c = tokenise_comment(&ctx, c);
-		else if (c == '[')
-			c = tokenise_bracket(&ctx, c);
-		else if (c == '\t')
-			c = tokenise_blockquote(&ctx, c);
-		else if (c == '\n')
-			c = tokenise_newline(&ctx, c, false);
-		else if (c == '#')
-			c = tokenise_heading(&ctx, c);
-		else if (c == '*')
-			c = tokenise_unordered_list(&ctx, c);
-		else if (c >= '1' && c <= '9')
-			c = tokenise_ordered_list_arabic(&ctx, c);
-		else if (c >= 'a' && c <= 'z')
-			c = tokenise_ordered_list_letter(&ctx, c, false);
-		else if (c == 'I' || c == 'V' || c == 'X')
-			c = tokenise_ordered_list_roman(&ctx, c);
-		else
-			c = tokenise_paragraph(&ctx, c, false);
+		case line_class_bracket:
+			c = tokenise_bracket(ctx, c);
+			break;
+		case line_class_blockquote:
+			c = tokenise_blockquote(ctx, c);
+			break;
+		case line_class_new_line:
+			c = tokenise_newline(ctx, c, false);
+			break;
+		case line_class_heading:
+			c = tokenise_heading(ctx, c);
+			break;
+		case line_class_unordered_list:
+			c = tokenise_unordered_list(ctx, c);
+			break;
+		case line_class_ordered_list_arabic:
+			c = tokenise_ordered_list_arabic(ctx, c);
+			break;
+		case line_class_ordered_list_letter:
+			c = tokenise_ordered_list_letter(ctx, c, false);
+			break;
+		case line_class_ordered_list_roman:
+			c = tokenise_ordered_list_roman(ctx, c);
+			break;
+		default:
+			c = tokenise_paragraph(ctx, c, false);
+		}
 	}
 
+	return c;
+}
+
+static void add_final_tokens(tokenise_context* ctx)
+{
 	/*
 		Make later parsing simpler by allowing validadation functions to check for only new lines,
 		without having to also check for end of file.
 	*/
-	add_line_token(&ctx, line_token_type_newline);
+	add_line_token(ctx, line_token_type_newline);
+
+	add_line_token(ctx, line_token_type_eof);
+}
+
+enum
+{
+	parallel_tokenise_min_size	= 1024 * 1024,
+	tokenise_chunk_min_size		= 256 * 1024,
+	max_tokenise_chunks			= 64
+};
+
+typedef struct
+{
+	tokenise_context	ctx;
+	arena				memory;
+	document_metadata	metadata;
+	error_context		error;
+	uint32_t			offset;
+	uint32_t			size;
+	bool				failed;
+} tokenise_chunk;
+
+typedef struct
+{
+	const source_text*	source;
+	char*				buffer;
+	arena*				memory;
+	tokenise_chunk*		chunks;
+	uint32_t			chunk_count;
+} tokenise_chunks;
+
+/*
+	Splits the source at chapter headings, each the "# " at the start of a line. Comments have already
+	been removed, so no heading found here can be inside one. Each chunk is at least target_size
+	bytes, so short chapters are grouped together. Returns the number of chunks.
+*/
+static uint32_t find_tokenise_chunks(const char* data, uint32_t size, uint32_t target_size, uint32_t* offsets)
+{
+	const char* end = data + size;
+	const char* chunk_start = data;
+
+	uint32_t count = 1;
+	offsets[0] = 0;
+
+	for (const char* hash = memchr(data, '#', size); hash; hash = memchr(hash + 1, '#', end - hash - 1))
+	{
+		if (hash > data && hash[-1] == '\n' && hash[1] == ' ' && hash - chunk_start >= target_size)
+		{
+			chunk_start = hash;
+			offsets[count++] = (uint32_t)(hash - data);
+			if (count == max_tokenise_chunks)
+				break;
+		}
+	}
+
+	return count;
+}
+
+/*
+	Tokenises one chunk with its own tokens and arena. Line numbers start from 1 and are offset when
+	the chunks are stitched together. Text is written at the chunk's own offset in the shared
+	buffer, which is safe because tokenising never makes text longer. Any error just marks the chunk
+	as failed, since the whole document is then tokenised again on one thread to report it exactly.
+*/
+static void tokenise_chunk_job(void* data, uint32_t index)
+{
+	tokenise_chunks* chunks = data;
+	tokenise_chunk* chunk = &chunks->chunks[index];
+	const uint64_t trace_start = trace_begin();
+
+	// The first chunk allocates from the document arena, so its metadata outlives the chunk
+	const bool first = index == 0;
+	arena* memory = first ? chunks->memory : &chunk->memory;
+
+	error_context* previous_error = get_error_context();
+	if (setjmp(chunk->error.recover) == 0)
+	{
+		set_error_context(&chunk->error);
+
+		tokenise_context* ctx = &chunk->ctx;
+		init_tokenise_context(ctx, chunks->source, chunk->offset, chunk->size, chunks->buffer, chunks->buffer + chunk->offset, memory, &chunk->metadata);
+
+		// A null character at the start of a line ends tokenising early, so check every chunk reached its end
+		const char* end = ctx->peek.read_ptr + chunk->size;
+		const bool last = index == chunks->chunk_count - 1;
+		const char c = tokenise_lines(ctx, end);
+		if (c != (last ? 0 : '#') || ctx->peek.read_ptr != end + 1)
+			chunk->failed = true;
+		else if (last)
+			add_final_tokens(ctx);
+	}
+	else
+	{
+		chunk->failed = true;
+	}
+
+	set_error_context(previous_error);
+
+	trace_end("tokenise_chunk", nullptr, trace_start, chunk->size);
+}
+
+static bool has_metadata(const document_metadata* metadata)
+{
+	return metadata->type != document_type_none || metadata->title || metadata->authors || metadata->translators;
+}
+
+/*
+	Large documents are tokenised one group of chapters per thread, then the tokens are stitched
+	back together in order. Returns false if the document should be tokenised on one thread instead,
+	either because it is too small to split, because it still has comments that cause an error,
+	because it is already being converted on a job thread in a batch, or because a chunk failed.
+	Metadata after the first chunk also falls back, since duplicate metadata errors depend on the
+	chunks before it.
+*/
+static bool tokenise_parallel(const source_text* source, char* buffer, arena* memory, line_tokens* out_tokens, document_metadata* metadata)
+{
+	const uint32_t core_count = get_core_count();
+	if (source->size < parallel_tokenise_min_size || source->has_comments || core_count == 1 || is_running_job())
+		return false;
+
+	const char* data = source->text;
+	const uint32_t size = source->size;
+
+	uint32_t target_size = size / (core_count * 2);
+	if (target_size < tokenise_chunk_min_size)
+		target_size = tokenise_chunk_min_size;
+
+	uint32_t offsets[max_tokenise_chunks];
+	const uint32_t chunk_count = find_tokenise_chunks(data, size, target_size, offsets);
+	if (chunk_count == 1)
+		return false;
+
+	const arena_mark mark = arena_get_mark(memory);
+
+	tokenise_chunks chunks = {
+		.source			= source,
+		.buffer			= buffer,
+		.memory			= memory,
+		.chunks			= arena_alloc(memory, sizeof(tokenise_chunk) * chunk_count),
+		.chunk_count	= chunk_count
+	};
+
+	for (uint32_t i = 0; i < chunk_count; ++i)
+	{
+		const uint32_t end = i + 1 < chunk_count ? offsets[i + 1] : size;
+		chunks.chunks[i] = (tokenise_chunk){
+			.metadata	= i == 0 ? *metadata : (document_metadata){},
+			.offset		= offsets[i],
+			.size		= end - offsets[i]
+		};
+	}
+
+	run_jobs(tokenise_chunk_job, &chunks, chunk_count);
+
+	bool failed = false;
+	line_tokens tokens = {
+		.text	= buffer
+	};
+
+	for (uint32_t i = 0; i < chunk_count; ++i)
+	{
+		const tokenise_chunk* chunk = &chunks.chunks[i];
+		if (chunk->failed || (i > 0 && has_metadata(&chunk->metadata)))
+			failed = true;
+
+		tokens.count += chunk->ctx.tokens.count;
+		tokens.span_count += chunk->ctx.tokens.span_count;
+		tokens.control_count += chunk->ctx.tokens.control_count;
+	}
+
+	if (!failed)
+	{
+		tokens.types = arena_alloc(memory, tokens.count);
+		tokens.span_indices = arena_alloc(memory, sizeof(uint32_t) * tokens.count);
+		tokens.lines = arena_alloc(memory, sizeof(uint32_t) * tokens.count);
+		tokens.indices = arena_alloc(memory, sizeof(uint32_t) * tokens.count);
+		tokens.spans = arena_alloc(memory, sizeof(text_span) * tokens.span_count);
+		tokens.controls = arena_alloc(memory, sizeof(uint32_t) * tokens.control_count);
+
+		// Span offsets already point into the shared buffer, so only indices and lines are rebased
+		uint32_t token_base = 0;
+		uint32_t span_base = 0;
+		uint32_t control_base = 0;
+		uint32_t line_base = 0;
+		for (uint32_t i = 0; i < chunk_count; ++i)
+		{
+			const line_tokens* chunk = &chunks.chunks[i].ctx.tokens;
+
+			memcpy(tokens.types + token_base, chunk->types, chunk->count);
+			memcpy(tokens.indices + token_base, chunk->indices, sizeof(uint32_t) * chunk->count);
+			for (uint32_t j = 0; j < chunk->count; ++j)
+			{
+				tokens.span_indices[token_base + j] = chunk->span_indices[j] + span_base;
+				tokens.lines[token_base + j] = chunk->lines[j] + line_base;
+			}
+
+			for (uint32_t j = 0; j < chunk->span_count; ++j)
+			{
+				text_span span = chunk->spans[j];
+				span.first_control += control_base;
+				tokens.spans[span_base + j] = span;
+			}
+
+			memcpy(tokens.controls + control_base, chunk->controls, sizeof(uint32_t) * chunk->control_count);
+
+			token_base += chunk->count;
+			span_base += chunk->span_count;
+			control_base += chunk->control_count;
+
+			// Every chunk but the last ends on a new line, so the next one starts on the line after
+			line_base += count_newlines(data + chunks.chunks[i].offset, chunks.chunks[i].size);
+		}
+
+		*metadata = chunks.chunks[0].metadata;
+		*out_tokens = tokens;
+	}
+
+	for (uint32_t i = 1; i < chunk_count; ++i)
+		arena_free(&chunks.chunks[i].memory);
+
+	if (failed)
+		arena_restore(memory, mark);
+
+	return !failed;
+}
+
+static void tokenise(const char* data, uint32_t size, arena* memory, line_tokens* out_tokens, document_metadata* metadata)
+{
+	// Text is copied into the generated documents as it is, and readers reject invalid UTF-8
+	const uint32_t invalid_offset = find_invalid_utf8(data, size);
+	if (invalid_offset != size)
+		handle_source_error(data, invalid_offset, "Invalid UTF-8 character; source files must be saved with UTF-8 encoding, and this error may also be caused by file corruption.");
+
+	source_text source;
+	normalise_source(data, size, memory, &source);
+
+	/*
+		Tokenised text is written to a separate buffer so the source is never modified. Tokenising
+		only ever removes or replaces characters, so the output can never be larger than the source.
+		The buffer, tokens and metadata all live in the document arena.
+	*/
+	char* buffer = arena_alloc(memory, source.size + 1);
+
+	if (tokenise_parallel(&source, buffer, memory, out_tokens, metadata))
+		return;
 
-	add_line_token(&ctx, line_token_type_eof);
-	out_tokens->lines = ctx.lines;
-	out_tokens->count = ctx.line_count;
-}
\ No newline at end of file
+	tokenise_context ctx;
+	init_tokenise_context(&ctx, &source, 0, source.size, buffer, buffer, memory, metadata);
+
+	tokenise_lines(&ctx, source.text + source.size);
+
+	add_final_tokens(&ctx);
+	*out_tokens = ctx.tokens;
+}
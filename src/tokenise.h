@@ -42,22 +42,26 @@ typedef enum
 	text_token_type_right_square_bracket	= 14
 } text_token_type;
 
-typedef struct
-{
-	line_token_type	type;
-	uint32_t		line;
-	char*			text;
-	uint32_t		index;
-	uint32_t		length;
-	uint32_t		padding[2];
-} line_token;
-static_assert(sizeof(line_token) == 32);								// Prevent accidental change
-static_assert((sizeof(line_token) & (sizeof(line_token) - 1)) == 0);	// Ensure power of two
+static_assert(line_token_type_ordered_list_letter <= UINT8_MAX);	// Types are stored as bytes
 
+/*
+	Line tokens are stored as parallel arrays, so validation, which mostly branches on the type
+	alone, reads a single byte per token. Tokens with text refer to a span of the tokenised text
+	buffer. Source lines are only read when reporting errors, and indices only for lists and
+	references.
+*/
 typedef struct
 {
-	line_token*	lines;
+	uint8_t*	types;
+	uint32_t*	span_indices;
+	uint32_t*	lines;
+	uint32_t*	indices;
+	char*		text;
+	text_span*	spans;
+	uint32_t*	controls;
 	uint32_t	count;
+	uint32_t	span_count;
+	uint32_t	control_count;
 } line_tokens;
 
-static void tokenise(char* data, line_tokens* out_tokens, document_metadata* metadata);
\ No newline at end of file
+static void tokenise(const char* data, uint32_t size, arena* memory, line_tokens* out_tokens, document_metadata* metadata);
\ No newline at end of file
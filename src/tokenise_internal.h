@@ -1,33 +1,63 @@
+// Only the line count is tracked, since columns are worked out when an error is reported
 typedef struct
 {
 	const char*	read_ptr;
-	uint32_t	line;
-	uint32_t	column;
 	uint32_t	next_line;
-	uint32_t	next_column;
-	uint32_t	prev_line;
-	uint32_t	prev_column;
 	char		c;
 	char		pc;
 } peek_state;
 
+// Marks where bytes were removed from the source, with the running total removed before offset
 typedef struct
 {
-	char*				buffer;
-	char*				write_ptr;
-	line_token*			current_line;
-	line_token*			lines;
-	uint32_t			line_count;
-	uint32_t			line_capacity;
-	uint32_t			ref_count;
-	peek_state			peek;
-	document_metadata*	metadata;
+	uint32_t	offset;
+	uint32_t	removed;
+} source_offset;
+
+/*
+	Source text prepared for tokenising, with each "\r\n" collapsed to a new line and range comments
+	removed. Offsets record how many bytes, and separately how many new lines, were removed before
+	each point, so positions can be mapped back to the original source. If a range comment would
+	cause an error, the source is left as it is and the tokeniser handles comments itself.
+*/
+typedef struct
+{
+	const char*				original;
+	const char*				text;
+	uint32_t				size;
+	bool					has_comments;
+	const source_offset*	offsets;
+	uint32_t				offset_count;
+	const source_offset*	line_offsets;
+	uint32_t				line_offset_count;
+} source_text;
+
+typedef struct
+{
+	const source_text*		source;
+	char*					buffer;
+	char*					write_ptr;
+	line_tokens				tokens;
+	uint32_t				token_capacity;
+	uint32_t				control_capacity;
+	uint32_t				ref_count;
+	peek_state				peek;
+	uint32_t				line_offset_index;	// First removed new line not yet counted in line numbers
+	uint32_t				removed_lines;
+	document_metadata*		metadata;
+	arena*					memory;
 } tokenise_context;
 
-static void handle_peek_error(const peek_state* peek, const char* format, ...);
+static void handle_peek_error(const tokenise_context* ctx, const peek_state* peek, const char* format, ...);
 static void handle_tokenise_error(const tokenise_context* ctx, const char* format, ...);
-static line_token* add_line_token(tokenise_context* ctx, line_token_type type);
+static uint32_t add_line_token(tokenise_context* ctx, line_token_type type);
 static void peek_init(tokenise_context* ctx, peek_state* peek);
 static char peek_char(tokenise_context* ctx, peek_state* peek);
 static void peek_apply(tokenise_context* ctx, peek_state* peek);
-static char get_char(tokenise_context* ctx);
\ No newline at end of file
+static char get_char(tokenise_context* ctx);
+static const char* scan_plain_text(const char* text);
+static const char* scan_source_breaks(const char* text);
+static uint32_t count_newlines(const char* text, uint32_t size);
+static uint32_t find_invalid_utf8(const char* text, uint32_t size);
+static void normalise_source(const char* data, uint32_t size, arena* memory, source_text* out);
+static uint32_t count_source_offsets(const source_offset* offsets, uint32_t count, uint32_t offset);
\ No newline at end of file
@@ -74,16 +74,16 @@ static const char* parse_metadata_text(tokenise_context* ctx)
 		const char c = peek_char(ctx, &peek);
 		if (c == '\n')
 		{
-			handle_peek_error(&peek, "New lines are not permitted within metadata tags \"[...]\".");
+			handle_peek_error(ctx, &peek, "New lines are not permitted within metadata tags \"[...]\".");
 		}
 		else if (c == '\t')
 		{
-			handle_peek_error(&peek, "Tabs are not permitted within metadata values.");
+			handle_peek_error(ctx, &peek, "Tabs are not permitted within metadata values.");
 		}
 		else if (c == ']')
 		{
 			if (peek.pc == ' ')
-				handle_peek_error(&peek, "Trailing spaces are not permitted.");
+				handle_peek_error(ctx, &peek, "Trailing spaces are not permitted.");
 
 			break;
 		}
@@ -95,7 +95,7 @@ static const char* parse_metadata_text(tokenise_context* ctx)
 		handle_tokenise_error(ctx, "Metadata text expected.");
 
 	// Allocate text memory including null terminator
-	char* text = malloc(len + 1);
+	char* text = arena_alloc(ctx->memory, len + 1);
 	text[len] = 0;
 
 	// Copy string data
@@ -136,16 +136,16 @@ static const char** parse_metadata_list(tokenise_context* ctx, uint32_t* out_cou
 		}
 		else if (c == '\n')
 		{
-			handle_peek_error(&peek, "New lines are not permitted within metadata tags \"[...]\".");
+			handle_peek_error(ctx, &peek, "New lines are not permitted within metadata tags \"[...]\".");
 		}
 		else if (c == '\t')
 		{
-			handle_peek_error(&peek, "Tabs are not permitted within metadata values.");
+			handle_peek_error(ctx, &peek, "Tabs are not permitted within metadata values.");
 		}
 		else if (c == ']')
 		{
 			if (peek.pc == ' ')
-				handle_peek_error(&peek, "Trailing spaces are not permitted.");
+				handle_peek_error(ctx, &peek, "Trailing spaces are not permitted.");
 
 			break;
 		}
@@ -160,8 +160,8 @@ static const char** parse_metadata_list(tokenise_context* ctx, uint32_t* out_cou
 		handle_tokenise_error(ctx, "Metadata list expected.");
 
 	// Allocate memory
-	char** list = malloc(sizeof(char**) * count);
-	char* text = malloc(len + count); // One null terminator per string
+	char** list = arena_alloc(ctx->memory, sizeof(char**) * count);
+	char* text = arena_alloc(ctx->memory, len + count); // One null terminator per string
 
 	// Assign first list item outside loop to simplify loop
 	list[0] = text;
@@ -199,6 +199,13 @@ static const char** parse_metadata_list(tokenise_context* ctx, uint32_t* out_cou
 	return list;
 }
 
+noreturn static void handle_metadata_value_error(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	report_error("", format, args);
+}
+
 static int parse_metadata_enum(tokenise_context* ctx, const char* name, const char** strings, int count)
 {
 	eat_metadata_spaces(ctx);
@@ -234,12 +241,13 @@ static int parse_metadata_enum(tokenise_context* ctx, const char* name, const ch
 		}
 	}
 
-	fprintf(stderr, "Unknown metadata value for attribute \"%s\". Valid values are:\n", name);
-	for (int i = 0; i < count; ++i)
-		fprintf(stderr, "%s\n", strings[i]);
+	// List the valid values one per line after the message
+	char values[256];
+	int len = 0;
+	for (int i = 0; i < count && len < sizeof(values); ++i)
+		len += snprintf(values + len, sizeof(values) - len, "\n%s", strings[i]);
 
-	assert(false);
-	exit(EXIT_FAILURE);
+	handle_metadata_value_error("Unknown metadata value for attribute \"%s\". Valid values are:%s", name, values);
 }
 
 static void parse_metadata_type(tokenise_context* ctx)
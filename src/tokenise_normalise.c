@@ -0,0 +1,209 @@
+/*
+	Sources often have "\r\n" line endings and range comments throughout. Both are removed before
+	tokenising, so the tokeniser's inner loop never has to check for them, and positions are mapped
+	back to the original source when an error is reported.
+
+	Comments are found exactly as peek_char finds them: the '*' that opens a comment can also close
+	it, and the character straight after a closed comment is never the start of another one.
+*/
+
+typedef struct
+{
+	source_offset*	data;
+	uint32_t		count;
+	uint32_t		capacity;
+} source_offset_list;
+
+static void add_source_offset(arena* memory, source_offset_list* list, uint32_t offset, uint32_t removed)
+{
+	if (list->count == list->capacity)
+	{
+		const uint32_t capacity = list->capacity ? list->capacity * 2 : 256;
+		list->data = arena_grow(memory, list->data, sizeof(source_offset) * list->capacity, sizeof(source_offset) * capacity);
+		list->capacity = capacity;
+	}
+
+	list->data[list->count++] = (source_offset){
+		.offset		= offset,
+		.removed	= removed
+	};
+}
+
+/*
+	Returns the '*' that closes the comment whose opening '*' is at start, and counts the new lines
+	inside it. Returns nullptr if the comment isn't closed, or holds a character that the tokeniser
+	would report an error for, since the error can only be reported exactly by tokenising it.
+*/
+static const char* find_comment_end(const char* start, uint32_t* out_newlines)
+{
+	// The search starts on the opening '*'
+	const char* close = start;
+	for (;;)
+	{
+		close = strchr(close, '*');
+		if (!close)
+			return nullptr;
+
+		if (close[1] == '/')
+			break;
+
+		++close;
+	}
+
+	uint32_t newlines = 0;
+	for (const char* c = start + 1; c < close; ++c)
+	{
+		const uint8_t b = *c;
+		if (b == '\n')
+			++newlines;
+		else if (b == '\r' && c[1] == '\n')
+			continue;
+		else if ((b < ' ' && b != '\t') || b == 127)
+			return nullptr;
+	}
+
+	*out_newlines = newlines;
+
+	return close;
+}
+
+// Discards any copy, and has the tokeniser read the source as it is, handling comments itself
+static void keep_original_source(arena* memory, arena_mark mark, const char* data, uint32_t size, source_text* out)
+{
+	arena_restore(memory, mark);
+
+	*out = (source_text){
+		.original		= data,
+		.text			= data,
+		.size			= size,
+		.has_comments	= true
+	};
+}
+
+/*
+	Most sources need neither change, so they are tokenised in place and only copied from the first
+	character that has to be removed. Control characters, including null characters before the end,
+	are kept so the tokeniser handles them as before. A lone carriage return is an error that removing
+	a comment could hide by joining it to a new line, so the source is then kept as it is.
+*/
+static void normalise_source(const char* data, uint32_t size, arena* memory, source_text* out)
+{
+	*out = (source_text){
+		.original	= data,
+		.text		= data,
+		.size		= size
+	};
+
+	const char* end = data + size;
+	const char* p = data;
+	for (;;)
+	{
+		p = scan_source_breaks(p);
+		if (p == end)
+		{
+			return;
+		}
+		else if (*p == '\r' && p[1] != '\n')
+		{
+			out->has_comments = true;
+			return;
+		}
+		else if (*p == '\r' || (*p == '/' && p[1] == '*'))
+		{
+			break;
+		}
+
+		++p;
+	}
+
+	const arena_mark mark = arena_get_mark(memory);
+
+	// Removing characters can only make the text shorter
+	char* text = arena_alloc(memory, size + 1);
+	char* write_ptr = text + (p - data);
+	memcpy(text, data, p - data);
+
+	source_offset_list offsets = {};
+	source_offset_list line_offsets = {};
+	uint32_t removed = 0;
+	uint32_t removed_lines = 0;
+
+	for (;;)
+	{
+		const char* next = scan_source_breaks(p);
+		memcpy(write_ptr, p, next - p);
+		write_ptr += next - p;
+		p = next;
+
+		const uint32_t offset = (uint32_t)(write_ptr - text);
+		if (p == end)
+		{
+			break;
+		}
+		else if (*p == '\r')
+		{
+			if (p[1] != '\n')
+			{
+				keep_original_source(memory, mark, data, size, out);
+				return;
+			}
+
+			// Drop the '\r', and the '\n' is copied with the next run
+			++p;
+			add_source_offset(memory, &offsets, offset, ++removed);
+		}
+		else if (*p == '/' && p[1] == '*')
+		{
+			uint32_t newlines;
+			const char* close = find_comment_end(p + 1, &newlines);
+			if (!close)
+			{
+				keep_original_source(memory, mark, data, size, out);
+				return;
+			}
+
+			removed += (uint32_t)(close + 2 - p);
+			add_source_offset(memory, &offsets, offset, removed);
+
+			if (newlines)
+			{
+				removed_lines += newlines;
+				add_source_offset(memory, &line_offsets, offset, removed_lines);
+			}
+
+			p = close + 2;
+			if (*p == '/')
+				*write_ptr++ = *p++;
+		}
+		else
+		{
+			*write_ptr++ = *p++;
+		}
+	}
+
+	*write_ptr = 0;
+
+	out->text = text;
+	out->size = (uint32_t)(write_ptr - text);
+	out->offsets = offsets.data;
+	out->offset_count = offsets.count;
+	out->line_offsets = line_offsets.data;
+	out->line_offset_count = line_offsets.count;
+}
+
+// Returns how many offsets are at or before offset
+static uint32_t count_source_offsets(const source_offset* offsets, uint32_t count, uint32_t offset)
+{
+	uint32_t low = 0;
+	uint32_t high = count;
+	while (low < high)
+	{
+		const uint32_t mid = low + (high - low) / 2;
+		if (offsets[mid].offset <= offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
@@ -0,0 +1,106 @@
+typedef struct
+{
+	const char*	name;
+	char		detail[120];
+	uint32_t	thread_id;
+	uint64_t	start_ns;
+	uint64_t	duration_ns;
+	uint64_t	bytes;
+} trace_event;
+
+static const char* trace_path;
+static FILE* trace_output;
+static uint64_t trace_start_ns;
+static trace_event* trace_events;
+static uint32_t trace_event_count;
+static uint32_t trace_event_capacity;
+static mutex trace_lock = MUTEX_INIT;
+
+// Threads are numbered in the order they first record a span, the main thread first
+static volatile uint32_t trace_thread_count;
+static thread_local uint32_t trace_thread_id;
+
+/*
+	Runs from atexit, where handle_error would call exit again, so write failures are only reported.
+	The file was opened by start_trace so a bad path is caught before any document is converted.
+*/
+static void write_trace(void)
+{
+	// Trace event times are in microseconds
+	FILE* f = trace_output;
+	fputs("{\"traceEvents\":[\n", f);
+
+	for (uint32_t i = 0; i < trace_event_count; ++i)
+	{
+		const trace_event* event = &trace_events[i];
+
+		fprintf(f,
+			"{\"name\":\"%s\",\"cat\":\"press\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%llu",
+			event->name,
+			event->thread_id,
+			(event->start_ns - trace_start_ns) / 1e3,
+			event->duration_ns / 1e3,
+			(unsigned long long)event->bytes
+		);
+
+		if (event->detail[0])
+		{
+			fputs(",\"detail\":", f);
+			print_json_string(f, event->detail);
+		}
+
+		fprintf(f, "}}%s\n", i + 1 < trace_event_count ? "," : "");
+	}
+
+	fputs("],\"displayTimeUnit\":\"ms\"}\n", f);
+
+	const bool failed = ferror(f);
+	if (fclose(f) != 0 || failed)
+		fprintf(stderr, "Error: Unable to write trace file \"%s\".\n", trace_path);
+}
+
+// Must be called before any jobs start so every thread sees tracing enabled
+static void start_trace(const char* path)
+{
+	trace_output = open_file(path, file_mode_write);
+	trace_path = path;
+	trace_start_ns = get_time_ns();
+	atexit(write_trace);
+}
+
+static uint64_t trace_begin(void)
+{
+	return trace_path ? get_time_ns() : 0;
+}
+
+static void trace_end(const char* name, const char* detail, uint64_t start_ns, uint64_t bytes)
+{
+	if (!trace_path)
+		return;
+
+	trace_event event = {
+		.name			= name,
+		.start_ns		= start_ns,
+		.duration_ns	= get_time_ns() - start_ns,
+		.bytes			= bytes
+	};
+
+	if (detail)
+		snprintf(event.detail, sizeof(event.detail), "%s", detail);
+
+	if (!trace_thread_id)
+		trace_thread_id = atomic_fetch_increment(&trace_thread_count) + 1;
+	event.thread_id = trace_thread_id;
+
+	lock_mutex(&trace_lock);
+
+	if (trace_event_count == trace_event_capacity)
+	{
+		trace_event_capacity = trace_event_capacity ? trace_event_capacity * 2 : 256;
+		trace_events = mem_realloc(trace_events, sizeof(trace_event) * trace_event_capacity);
+	}
+
+	trace_events[trace_event_count++] = event;
+
+	unlock_mutex(&trace_lock);
+}
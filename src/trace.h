@@ -0,0 +1,8 @@
+/*
+	Spans recorded for --trace are written as Chrome trace events when the process exits, and can be
+	opened in Perfetto or chrome://tracing. While tracing is off trace_begin returns without reading
+	the clock and trace_end returns straight away.
+*/
+static void		start_trace(const char* path);
+static uint64_t	trace_begin(void);
+static void		trace_end(const char* name, const char* detail, uint64_t start_ns, uint64_t bytes);
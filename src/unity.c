@@ -1,9 +1,9 @@
 #include "press.h"
 #include "util.h"
+#include "trace.h"
 #include "document.h"
 #include "tokenise.h"
 #include "validate.h"
-#include "finalise.h"
 #include "generate.h"
 
 #include "roman_numeral.c"
@@ -12,11 +12,14 @@
 #include "html.c"
 #include "epub.c"
 #include "validate.c"
-#include "finalise.c"
 #include "util.c"
+#include "trace.c"
 #include "zip.c"
 #include "crc32.c"
+#include "deflate.c"
 
 #include "tokenise_internal.h"
+#include "scan.c"
+#include "tokenise_normalise.c"
 #include "tokenise_metadata.c"
 #include "tokenise.c"
\ No newline at end of file
@@ -1,14 +1,337 @@
+#if defined(PRESS_TRACK_ALLOCATIONS)
+typedef struct
+{
+	const char*	file;
+	int			line;
+	uint64_t	calls;
+	uint64_t	bytes;
+	uint64_t	live_bytes;
+	uint64_t	peak_bytes;
+} allocation_site;
+
+// Stored in front of every tracked block so frees can be credited to the site that allocated it
+typedef struct
+{
+	uint64_t	size;
+	uint32_t	site;
+	uint32_t	padding;
+} allocation_header;
+static_assert(sizeof(allocation_header) == 16);	// Keep blocks aligned for any type
+
+enum
+{
+	allocation_site_capacity = 1024,
+	allocation_site_total = allocation_site_capacity,		// Extra entry holding the sum of every site
+	allocation_site_other = allocation_site_capacity + 1	// Extra entry for sites added once the table is half full
+};
+
+static allocation_site allocation_sites[allocation_site_capacity + 2];
+static uint32_t allocation_site_count;
+static bool allocation_report_registered;
+
+static mutex allocation_lock = MUTEX_INIT;
+
+static int compare_allocation_sites(const void* a, const void* b)
+{
+	const allocation_site* site_a = a;
+	const allocation_site* site_b = b;
+
+	if (site_a->bytes != site_b->bytes)
+		return site_a->bytes < site_b->bytes ? 1 : -1;
+
+	return site_a->line - site_b->line;
+}
+
+static void print_allocation_site(const allocation_site* site, const char* name)
+{
+	fprintf(stderr, "%10llu %14llu %14llu  ", (unsigned long long)site->calls, (unsigned long long)site->bytes, (unsigned long long)site->peak_bytes);
+
+	if (site->file)
+		fprintf(stderr, "%s:%d\n", site->file, site->line);
+	else
+		fprintf(stderr, "%s\n", name);
+}
+
+static void print_allocation_report(void)
+{
+	// Keep the report after anything already printed
+	fflush(stdout);
+
+	lock_mutex(&allocation_lock);
+
+	allocation_site sites[allocation_site_capacity];
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < allocation_site_capacity; ++i)
+	{
+		if (allocation_sites[i].file)
+			sites[count++] = allocation_sites[i];
+	}
+
+	const allocation_site total = allocation_sites[allocation_site_total];
+	const allocation_site other = allocation_sites[allocation_site_other];
+
+	unlock_mutex(&allocation_lock);
+
+	qsort(sites, count, sizeof(allocation_site), compare_allocation_sites);
+
+	fprintf(stderr, "\nAllocations by call site:\n%10s %14s %14s  %s\n", "calls", "bytes", "peak bytes", "site");
+	for (uint32_t i = 0; i < count; ++i)
+		print_allocation_site(&sites[i], nullptr);
+	if (other.calls)
+		print_allocation_site(&other, "other sites");
+	print_allocation_site(&total, "total");
+}
+
+/*
+	Returns the index of the call site, adding it if this is its first allocation. Lock must be held.
+	The table is kept at most half full so probes stay short and always reach an empty entry; sites
+	that don't fit are counted together instead.
+*/
+static uint32_t find_allocation_site(const char* file, int line)
+{
+	const uint32_t mask = allocation_site_capacity - 1;
+	uint32_t index = ((uint32_t)(uintptr_t)file * 31 + (uint32_t)line) & mask;
+
+	for (;;)
+	{
+		allocation_site* site = &allocation_sites[index];
+		if (!site->file)
+		{
+			if (allocation_site_count == allocation_site_capacity / 2)
+				return allocation_site_other;
+
+			site->file = file;
+			site->line = line;
+			++allocation_site_count;
+
+			return index;
+		}
+
+		// The same file name may be stored at more than one address
+		if (site->line == line && (site->file == file || strcmp(site->file, file) == 0))
+			return index;
+
+		index = (index + 1) & mask;
+	}
+}
+
+static void add_site_bytes(allocation_site* site, uint64_t size)
+{
+	++site->calls;
+	site->bytes += size;
+	site->live_bytes += size;
+
+	if (site->live_bytes > site->peak_bytes)
+		site->peak_bytes = site->live_bytes;
+}
+
+static void remove_site_bytes(allocation_site* site, uint64_t size)
+{
+	site->live_bytes -= size;
+}
+
+// Records a new or resized block, first releasing the bytes previously held by the old block
+static void* record_allocation(allocation_header* header, const allocation_header* old, size_t size, const char* file, int line)
+{
+	if (!header)
+		handle_error("Out of memory.");
+
+	lock_mutex(&allocation_lock);
+
+	if (!allocation_report_registered)
+	{
+		atexit(print_allocation_report);
+		allocation_report_registered = true;
+	}
+
+	if (old)
+	{
+		remove_site_bytes(&allocation_sites[old->site], old->size);
+		remove_site_bytes(&allocation_sites[allocation_site_total], old->size);
+	}
+
+	header->size = size;
+	header->site = find_allocation_site(file, line);
+
+	add_site_bytes(&allocation_sites[header->site], size);
+	add_site_bytes(&allocation_sites[allocation_site_total], size);
+
+	unlock_mutex(&allocation_lock);
+
+	return header + 1;
+}
+
+static void* track_alloc(size_t size, const char* file, int line)
+{
+	return record_allocation(malloc(sizeof(allocation_header) + size), nullptr, size, file, line);
+}
+
+static void* track_calloc(size_t count, size_t size, const char* file, int line)
+{
+	if (size && count > (SIZE_MAX - sizeof(allocation_header)) / size)
+		handle_error("Out of memory.");
+
+	void* data = track_alloc(count * size, file, line);
+	memset(data, 0, count * size);
+
+	return data;
+}
+
+static void* track_realloc(void* data, size_t size, const char* file, int line)
+{
+	if (!data)
+		return track_alloc(size, file, line);
+
+	allocation_header* header = (allocation_header*)data - 1;
+	const allocation_header old = *header;
+
+	return record_allocation(realloc(header, sizeof(allocation_header) + size), &old, size, file, line);
+}
+
+static void track_free(void* data)
+{
+	if (!data)
+		return;
+
+	allocation_header* header = (allocation_header*)data - 1;
+
+	lock_mutex(&allocation_lock);
+	remove_site_bytes(&allocation_sites[header->site], header->size);
+	remove_site_bytes(&allocation_sites[allocation_site_total], header->size);
+	unlock_mutex(&allocation_lock);
+
+	free(header);
+}
+
+static void get_allocation_totals(uint64_t* out_calls, uint64_t* out_bytes)
+{
+	lock_mutex(&allocation_lock);
+	*out_calls = allocation_sites[allocation_site_total].calls;
+	*out_bytes = allocation_sites[allocation_site_total].bytes;
+	unlock_mutex(&allocation_lock);
+}
+#else
+static void* mem_alloc(size_t size)
+{
+	void* data = malloc(size);
+	if (!data && size)
+		handle_error("Out of memory.");
+
+	return data;
+}
+
+static void* mem_calloc(size_t count, size_t size)
+{
+	void* data = calloc(count, size);
+	if (!data && count && size)
+		handle_error("Out of memory.");
+
+	return data;
+}
+
+static void* mem_realloc(void* data, size_t size)
+{
+	void* new_data = realloc(data, size);
+	if (!new_data && size)
+		handle_error("Out of memory.");
+
+	return new_data;
+}
+
+static void mem_free(void* data)
+{
+	free(data);
+}
+#endif
+
+static bool make_dir(const char* dir)
+{
+#if defined(_WIN32)
+	return CreateDirectoryA(dir, nullptr) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	return mkdir(dir, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+/*
+	Creates a directory along with any missing parent directories. Directories that already exist
+	are left as they are.
+*/
 static void create_dir(const char* dir)
 {
-	char buffer[256];
-	const int len = snprintf(buffer, sizeof(buffer), "mkdir %s >nul 2>nul", dir);
-	assert(len < sizeof(buffer));
+	char path[512];
+	const size_t len = strlen(dir);
+	if (len >= sizeof(path))
+		handle_error("Directory path \"%s/\" too long.", dir);
+
+	memcpy(path, dir, len + 1);
+
+	/*
+		Create each parent in turn by temporarily terminating the path at its separator. Failures are
+		only reported for the full path, since parents such as drive roots can't be created but the
+		directories beneath them can.
+	*/
+	for (size_t i = 1; i < len; ++i)
+	{
+		if (path[i] != '/' && path[i] != '\\')
+			continue;
+
+		const char separator = path[i];
+		path[i] = 0;
+		make_dir(path);
+		path[i] = separator;
+	}
 
-	const int ret = system(buffer);
-	if (ret)
+	if (!make_dir(path))
 		handle_error("Unable to create directory \"%s/\"", dir);
 }
 
+#if !defined(_WIN32)
+static int delete_dir_entry(const char* path, const struct stat* info, int type, struct FTW* ftw)
+{
+	// Errors are ignored so that as much as possible is removed
+	remove(path);
+	return 0;
+}
+#endif
+
+/*
+	Deletes a directory and everything inside it. Missing directories are ignored.
+*/
+static void delete_dir(const char* dir)
+{
+#if defined(_WIN32)
+	const char* pattern = generate_path("%s/*", dir);
+
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA(pattern, &data);
+	mem_free((void*)pattern);
+
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0)
+			continue;
+
+		const char* path = generate_path("%s/%s", dir, data.cFileName);
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			delete_dir(path);
+		else
+			DeleteFileA(path);
+
+		mem_free((void*)path);
+	} while (FindNextFileA(find, &data));
+
+	FindClose(find);
+	RemoveDirectoryA(dir);
+#else
+	// Visit directory contents before the directory itself, without following symbolic links
+	nftw(dir, delete_dir_entry, 16, FTW_DEPTH | FTW_PHYS);
+#endif
+}
+
 static FILE* open_file(const char* path, file_mode mode)
 {
 	const char* mode_string;
@@ -34,28 +357,324 @@ static uint32_t get_file_size(FILE* f)
 	return size;
 }
 
+static thread_local error_context* current_error_context;
+
 static void handle_error(const char* format, ...)
 {
-	fputs("Error: ", stderr);
-
 	va_list args;
 	va_start(args, format);
-	vfprintf(stderr, format, args);
-	va_end(args);
+	report_error("Error: ", format, args);
+}
+
+noreturn static void report_error(const char* prefix, const char* format, va_list args)
+{
+	error_context* ctx = current_error_context;
+	if (ctx)
+	{
+		const int len = snprintf(ctx->message, sizeof(ctx->message), "%s", prefix);
+		if (len >= 0 && len < sizeof(ctx->message))
+			vsnprintf(ctx->message + len, sizeof(ctx->message) - len, format, args);
 
+		// Cleanups run before the jump, while the locals they refer to are still on the stack
+		while (ctx->cleanup_count)
+		{
+			const error_cleanup* cleanup = &ctx->cleanups[--ctx->cleanup_count];
+			cleanup->function(cleanup->data);
+		}
+
+		longjmp(ctx->recover, 1);
+	}
+
+	fputs(prefix, stderr);
+	vfprintf(stderr, format, args);
 	fputc('\n', stderr);
 
 	assert(false);
 	exit(EXIT_FAILURE);
 }
 
+static void set_error_context(error_context* ctx)
+{
+	current_error_context = ctx;
+}
+
+static error_context* get_error_context(void)
+{
+	return current_error_context;
+}
+
+/*
+	Registers function to release data if an error is reported before the matching pop. Without an
+	error context, errors end the process, so nothing needs to be registered.
+*/
+static void push_error_cleanup(cleanup_function* function, void* data)
+{
+	error_context* ctx = current_error_context;
+	if (!ctx)
+		return;
+
+	assert(ctx->cleanup_count < max_error_cleanups);
+	ctx->cleanups[ctx->cleanup_count++] = (error_cleanup){
+		.function	= function,
+		.data		= data
+	};
+}
+
+// Cleanups may be popped in any order, since nested writers end at different points
+static void pop_error_cleanup(void* data)
+{
+	error_context* ctx = current_error_context;
+	if (!ctx)
+		return;
+
+	for (uint32_t i = ctx->cleanup_count; i-- > 0;)
+	{
+		if (ctx->cleanups[i].data == data)
+		{
+			memmove(&ctx->cleanups[i], &ctx->cleanups[i + 1], sizeof(error_cleanup) * (ctx->cleanup_count - i - 1));
+			--ctx->cleanup_count;
+			return;
+		}
+	}
+
+	assert(false);
+}
+
+static uint32_t get_core_count(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const long count = info.dwNumberOfProcessors;
+#else
+	const long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return count > 0 ? (uint32_t)count : 1;
+}
+
+static uint64_t get_time_ns(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+
+	// Split the conversion to avoid overflowing 64 bits
+	const uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+	const uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+	return seconds * 1000000000 + remainder * 1000000000 / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// Largest amount of physical memory the process has used so far, in bytes
+static uint64_t get_peak_rss(void)
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+#if defined(__APPLE__)
+	return (uint64_t)usage.ru_maxrss;			// Reported in bytes
+#else
+	return (uint64_t)usage.ru_maxrss * 1024;	// Reported in kilobytes
+#endif
+#endif
+}
+
+#if defined(CPU_X64)
+static bool cpu_has_pclmulqdq(void)
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] >> 1) & 1;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return (ecx >> 1) & 1;
+#endif
+}
+#endif
+
+typedef struct
+{
+	job_function*		function;
+	void*				data;
+	uint32_t			count;
+	volatile uint32_t	next;
+} job_queue;
+
+// Jobs started from within a job run on the calling thread rather than oversubscribing the cores
+static thread_local bool running_job;
+
+static uint32_t atomic_fetch_increment(volatile uint32_t* value)
+{
+#if defined(_MSC_VER)
+	return (uint32_t)_InterlockedIncrement((volatile long*)value) - 1;
+#else
+	return __atomic_fetch_add(value, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static uint32_t atomic_load_u32(volatile uint32_t* value)
+{
+#if defined(_MSC_VER)
+	return *value;	// Aligned loads are atomic on all supported targets
+#else
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+static void atomic_store_u32(volatile uint32_t* value, uint32_t new_value)
+{
+#if defined(_MSC_VER)
+	*value = new_value;
+#else
+	__atomic_store_n(value, new_value, __ATOMIC_RELAXED);
+#endif
+}
+
+static void lock_mutex(mutex* m)
+{
+#if defined(_WIN32)
+	AcquireSRWLockExclusive(m);
+#else
+	pthread_mutex_lock(m);
+#endif
+}
+
+static void unlock_mutex(mutex* m)
+{
+#if defined(_WIN32)
+	ReleaseSRWLockExclusive(m);
+#else
+	pthread_mutex_unlock(m);
+#endif
+}
+
+static void run_job_queue(job_queue* queue)
+{
+	const bool was_running_job = running_job;
+	running_job = true;
+
+	for (;;)
+	{
+		const uint32_t index = atomic_fetch_increment(&queue->next);
+		if (index >= queue->count)
+			break;
+
+		queue->function(queue->data, index);
+	}
+
+	running_job = was_running_job;
+}
+
+static void free_thread_arenas(void);
+
+#if defined(_WIN32)
+static DWORD WINAPI job_thread_main(void* data)
+{
+	run_job_queue(data);
+	free_thread_arenas();
+	return 0;
+}
+#else
+static void* job_thread_main(void* data)
+{
+	run_job_queue(data);
+	free_thread_arenas();
+	return nullptr;
+}
+#endif
+
+// Jobs started from here would run on this thread alone
+static bool is_running_job(void)
+{
+	return running_job;
+}
+
+/*
+	Runs function for every index below count on a pool of threads sized to the core count. Indices
+	are handed out one at a time, so long jobs don't hold up the rest of the queue, and the calling
+	thread works through the queue too. Returns once every job has finished.
+*/
+static void run_jobs(job_function* function, void* data, uint32_t count)
+{
+	enum { max_threads = 64 };
+
+	job_queue queue = {
+		.function	= function,
+		.data		= data,
+		.count		= count
+	};
+
+	uint32_t thread_count = running_job ? 1 : get_core_count();
+	if (thread_count > count)
+		thread_count = count;
+	if (thread_count > max_threads)
+		thread_count = max_threads;
+
+#if defined(_WIN32)
+	HANDLE threads[max_threads];
+#else
+	pthread_t threads[max_threads];
+#endif
+
+	// If a thread fails to start, the remaining threads pick up its share of the queue
+	uint32_t started = 0;
+	for (uint32_t i = 1; i < thread_count; ++i)
+	{
+#if defined(_WIN32)
+		threads[started] = CreateThread(nullptr, 0, job_thread_main, &queue, 0, nullptr);
+		if (!threads[started])
+			break;
+#else
+		if (pthread_create(&threads[started], nullptr, job_thread_main, &queue) != 0)
+			break;
+#endif
+		++started;
+	}
+
+	run_job_queue(&queue);
+
+	for (uint32_t i = 0; i < started; ++i)
+	{
+#if defined(_WIN32)
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], nullptr);
+#endif
+	}
+}
+
 static const char* generate_path(const char* format, ...)
 {
 	va_list args;
 	va_start(args, format);
 
-	const int len = vsnprintf(nullptr, 0, format, args);
-	char* path = malloc(len + 1);
+	// The argument list can't be reused after measuring, so measure with a copy
+	va_list args_copy;
+	va_copy(args_copy, args);
+	const int len = vsnprintf(nullptr, 0, format, args_copy);
+	va_end(args_copy);
+
+	char* path = mem_alloc(len + 1);
 
 	vsnprintf(path, len + 1, format, args);
 	va_end(args);
@@ -63,70 +682,350 @@ static const char* generate_path(const char* format, ...)
 	return path;
 }
 
-static void print_tabs(FILE* f, int depth)
+enum
+{
+	arena_block_size	= 1 << 20,
+	arena_alignment		= 16
+};
+
+static_assert(sizeof(arena_block) % arena_alignment == 0);	// Block data starts aligned
+
+static size_t align_arena_size(size_t size)
+{
+	return (size + arena_alignment - 1) & ~(size_t)(arena_alignment - 1);
+}
+
+static void use_arena_block(arena* a, arena_block* block)
 {
-	fputc('\n', f);
+	a->current = block;
+	a->ptr = (char*)(block + 1);
+	a->end = a->ptr + block->size;
+}
+
+static void next_arena_block(arena* a, size_t size)
+{
+	// Blocks kept by a reset are reused when they are large enough
+	arena_block* next = a->current ? a->current->next : a->first;
+	if (!next || next->size < size)
+	{
+		const size_t block_size = size > arena_block_size ? size : arena_block_size;
+
+		arena_block* block = mem_alloc(sizeof(arena_block) + block_size);
+		block->next = next;
+		block->size = block_size;
+
+		if (a->current)
+			a->current->next = block;
+		else
+			a->first = block;
+
+		next = block;
+	}
+
+	use_arena_block(a, next);
+}
+
+static void* arena_alloc(arena* a, size_t size)
+{
+	size = align_arena_size(size);
+	if (size > (size_t)(a->end - a->ptr))
+		next_arena_block(a, size);
+
+	void* data = a->ptr;
+	a->ptr += size;
+
+	return data;
+}
+
+/*
+	Growing the most recent allocation extends it in place when the block has room. Anything else is
+	copied to a new allocation and the old memory is left until the arena is reset.
+*/
+static void* arena_grow(arena* a, void* data, size_t old_size, size_t new_size)
+{
+	assert(new_size >= old_size);
+
+	char* end = (char*)data + align_arena_size(old_size);
+	if (data && end == a->ptr && align_arena_size(new_size) - align_arena_size(old_size) <= (size_t)(a->end - a->ptr))
+	{
+		a->ptr = (char*)data + align_arena_size(new_size);
+		return data;
+	}
+
+	void* grown = arena_alloc(a, new_size);
+	if (old_size)
+		memcpy(grown, data, old_size);
+
+	return grown;
+}
+
+static char* arena_format(arena* a, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+
+	va_list args_copy;
+	va_copy(args_copy, args);
+	const int len = vsnprintf(nullptr, 0, format, args_copy);
+	va_end(args_copy);
+
+	char* string = arena_alloc(a, len + 1);
+
+	vsnprintf(string, len + 1, format, args);
+	va_end(args);
+
+	return string;
+}
+
+/*
+	Restoring a mark releases everything allocated since it was taken. Marks must be restored in the
+	reverse order they were taken.
+*/
+static arena_mark arena_get_mark(const arena* a)
+{
+	return (arena_mark){
+		.block	= a->current,
+		.ptr	= a->ptr
+	};
+}
+
+static void arena_restore(arena* a, arena_mark mark)
+{
+	if (!mark.block)
+	{
+		arena_reset(a);
+		return;
+	}
+
+	use_arena_block(a, mark.block);
+	a->ptr = mark.ptr;
+}
+
+static void arena_reset(arena* a)
+{
+	a->current = nullptr;
+	a->ptr = nullptr;
+	a->end = nullptr;
+}
+
+static void arena_free(arena* a)
+{
+	arena_block* block = a->first;
+	while (block)
+	{
+		arena_block* next = block->next;
+		mem_free(block);
+		block = next;
+	}
+
+	*a = (arena){};
+}
+
+/*
+	Each thread has a document arena, holding everything that lives as long as the document being
+	converted, and a scratch arena for short-lived memory such as file names and compression state.
+	Worker threads free both when they finish.
+*/
+static thread_local arena document_arena;
+static thread_local arena scratch_arena;
+
+static arena* get_document_arena(void)
+{
+	return &document_arena;
+}
+
+static arena* get_scratch_arena(void)
+{
+	return &scratch_arena;
+}
+
+static void free_thread_arenas(void)
+{
+	arena_free(&document_arena);
+	arena_free(&scratch_arena);
+}
+
+static char* reserve_output(output_buffer* out, uint32_t size)
+{
+	const uint64_t required = (uint64_t)out->size + size;
+	if (required > out->capacity)
+	{
+		if (required >= UINT32_MAX)
+			handle_error("Output too large.");
+
+		uint64_t capacity = out->capacity ? out->capacity : (64 << 10);
+		while (capacity < required)
+			capacity *= 2;
+
+		if (capacity > UINT32_MAX)
+			capacity = UINT32_MAX;
+
+		out->data = mem_realloc(out->data, capacity);
+		out->capacity = (uint32_t)capacity;
+	}
+
+	return out->data + out->size;
+}
+
+// Counted per thread so that each document in a batch only sees its own output
+static thread_local uint64_t bytes_written;
+
+static void add_bytes_written(uint64_t size)
+{
+	bytes_written += size;
+}
+
+static uint64_t get_bytes_written(void)
+{
+	return bytes_written;
+}
+
+static void write_output(output_buffer* out, const char* dir, const char* filename)
+{
+	char path[512];
+	const int len = snprintf(path, sizeof(path), "%s/%s", dir, filename);
+	if (len < 0 || len >= sizeof(path))
+		handle_error("Output path \"%s/%s\" too long.", dir, filename);
+
+	// Close before reporting so a failed batch document doesn't leave the file open
+	FILE* f = open_file(path, file_mode_write);
+	const bool written = fwrite(out->data, 1, out->size, f) == out->size;
+	if (fclose(f) != 0 || !written)
+		handle_error("Unable to write file \"%s\".", path);
+
+	add_bytes_written(out->size);
+
+	// Keep the allocation so the next file can reuse it
+	out->size = 0;
+}
+
+static void free_output_buffer(void* out)
+{
+	output_buffer* buffer = out;
+	mem_free(buffer->data);
+	*buffer = (output_buffer){};
+}
+
+static void print_bytes(output_buffer* out, const char* data, uint32_t size)
+{
+	memcpy(reserve_output(out, size), data, size);
+	out->size += size;
+}
+
+static void print_string(output_buffer* out, const char* string)
+{
+	print_bytes(out, string, (uint32_t)strlen(string));
+}
+
+static void print_format(output_buffer* out, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+
+	va_list args_copy;
+	va_copy(args_copy, args);
+	const int len = vsnprintf(nullptr, 0, format, args_copy);
+	va_end(args_copy);
+
+	// Reserve space for the null terminator written by vsnprintf, but don't include it in the size
+	char* dst = reserve_output(out, len + 1);
+	vsnprintf(dst, len + 1, format, args);
+	out->size += len;
+
+	va_end(args);
+}
+
+static void print_utf8(output_buffer* out, uint8_t b0, uint8_t b1, uint8_t b2)
+{
+	char* dst = reserve_output(out, 3);
+	dst[0] = b0;
+	dst[1] = b1;
+	dst[2] = b2;
+	out->size += 3;
+}
+
+static void print_tabs(output_buffer* out, int depth)
+{
+	char* dst = reserve_output(out, depth + 1);
+	*dst++ = '\n';
 	for (int i = 0; i < depth; ++i)
-		fputc('\t', f);
+		*dst++ = '\t';
+
+	out->size += depth + 1;
 }
 
-static void print_en_dash(FILE* f)
+static void print_en_dash(output_buffer* out)
 {
-	fputc(0xE2, f);
-	fputc(0x80, f);
-	fputc(0x93, f);
+	print_utf8(out, 0xE2, 0x80, 0x93);
 }
 
-static void print_em_dash(FILE* f)
+static void print_em_dash(output_buffer* out)
 {
-	fputc(0xE2, f);
-	fputc(0x80, f);
-	fputc(0x94, f);
+	print_utf8(out, 0xE2, 0x80, 0x94);
 }
 
-static void print_apostrophe(FILE* f)
+static void print_apostrophe(output_buffer* out)
 {
-	fputc(0xE2, f);
-	fputc(0x80, f);
-	fputc(0x99, f);
+	print_utf8(out, 0xE2, 0x80, 0x99);
 }
 
-static void print_quote_level_1_begin(FILE* f)
+static void print_quote_level_1_begin(output_buffer* out)
 {
-	fputc(0xE2, f);
-	fputc(0x80, f);
-	fputc(0x9C, f);
+	print_utf8(out, 0xE2, 0x80, 0x9C);
 }
 
-static void print_quote_level_1_end(FILE* f)
+static void print_quote_level_1_end(output_buffer* out)
 {
-	fputc(0xE2, f);
-	fputc(0x80, f);
-	fputc(0x9D, f);
+	print_utf8(out, 0xE2, 0x80, 0x9D);
 }
 
-static void print_char(FILE* f, char c)
+static void print_char(output_buffer* out, char c)
 {
 	if (c == text_token_type_en_dash)
-		print_en_dash(f);
+	{
+		print_en_dash(out);
+	}
 	else if (c == text_token_type_em_dash)
-		print_em_dash(f);
+	{
+		print_em_dash(out);
+	}
 	else if (c == '\'')
-		print_apostrophe(f);
+	{
+		print_apostrophe(out);
+	}
 	else if (c == text_token_type_quote_level_1_begin)
-		print_quote_level_1_begin(f);
+	{
+		print_quote_level_1_begin(out);
+	}
 	else if (c == text_token_type_quote_level_1_end)
-		print_quote_level_1_end(f);
-	else if (c == text_token_type_left_square_bracket)
-		fputc('[', f);
-	else if (c == text_token_type_right_square_bracket)
-		fputc(']', f);
+	{
+		print_quote_level_1_end(out);
+	}
 	else
-		fputc(c, f);
+	{
+		if (c == text_token_type_left_square_bracket)
+			c = '[';
+		else if (c == text_token_type_right_square_bracket)
+			c = ']';
+
+		*reserve_output(out, 1) = c;
+		++out->size;
+	}
 }
 
-static void print_simple_text(FILE* f, const char* text)
+static void print_json_string(FILE* f, const char* string)
 {
-	while (*text)
-		print_char(f, *text++);
-}
\ No newline at end of file
+	fputc('"', f);
+
+	for (const char* c = string; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+			fprintf(f, "\\%c", *c);
+		else if ((uint8_t)*c < ' ')
+			fprintf(f, "\\u%04x", *c);
+		else
+			fputc(*c, f);
+	}
+
+	fputc('"', f);
+}
@@ -4,16 +4,147 @@ typedef enum
 	file_mode_write
 } file_mode;
 
+/*
+	Emitters write into a growable in-memory buffer rather than directly to a FILE*, so that output
+	is produced with bulk copies and handed off with a single write once a file is complete.
+*/
+typedef struct
+{
+	char*		data;
+	uint32_t	size;
+	uint32_t	capacity;
+} output_buffer;
+
+/*
+	Arenas hand out memory by bumping a pointer through a chain of blocks. Nothing is freed on its
+	own; resetting rewinds to the first block and keeps the chain, so a document or generator that
+	runs again reuses the same memory instead of going back to the heap.
+*/
+typedef struct arena_block arena_block;
+struct arena_block
+{
+	arena_block*	next;
+	size_t			size;
+};
+
+typedef struct
+{
+	arena_block*	first;
+	arena_block*	current;
+	char*			ptr;
+	char*			end;
+} arena;
+
+typedef struct
+{
+	arena_block*	block;
+	char*			ptr;
+} arena_mark;
+
+typedef void cleanup_function(void* data);
+
+typedef struct
+{
+	cleanup_function*	function;
+	void*				data;
+} error_cleanup;
+
+enum { max_error_cleanups = 8 };
+
+/*
+	While an error context is installed for the current thread, errors are captured into it and
+	control returns to the matching setjmp instead of ending the process. Batch mode uses this to
+	report every failing document after the rest have finished. Heap memory and files that an error
+	would skip releasing are registered as cleanups, which run before control returns.
+*/
+typedef struct
+{
+	jmp_buf			recover;
+	char			message[1024];
+	error_cleanup	cleanups[max_error_cleanups];
+	uint32_t		cleanup_count;
+} error_context;
+
+typedef void job_function(void* data, uint32_t index);
+
+// Statically initialised with MUTEX_INIT, so no setup is needed before threads start
+#if defined(_WIN32)
+	typedef SRWLOCK mutex;
+	#define MUTEX_INIT SRWLOCK_INIT
+#else
+	typedef pthread_mutex_t mutex;
+	#define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+/*
+	All heap memory goes through mem_alloc and friends. Building with PRESS_TRACK_ALLOCATIONS counts
+	calls, bytes and the peak bytes held for every call site and prints a report when the process
+	exits.
+*/
+#if defined(PRESS_TRACK_ALLOCATIONS)
+	#define mem_alloc(size)			track_alloc(size, __FILE__, __LINE__)
+	#define mem_calloc(count, size)	track_calloc(count, size, __FILE__, __LINE__)
+	#define mem_realloc(data, size)	track_realloc(data, size, __FILE__, __LINE__)
+	#define mem_free(data)			track_free(data)
+#endif
+
+#if defined(PRESS_TRACK_ALLOCATIONS)
+static void*		track_alloc(size_t size, const char* file, int line);
+static void*		track_calloc(size_t count, size_t size, const char* file, int line);
+static void*		track_realloc(void* data, size_t size, const char* file, int line);
+static void			track_free(void* data);
+static void			get_allocation_totals(uint64_t* out_calls, uint64_t* out_bytes);
+#else
+static void*		mem_alloc(size_t size);
+static void*		mem_calloc(size_t count, size_t size);
+static void*		mem_realloc(void* data, size_t size);
+static void			mem_free(void* data);
+#endif
 static void			create_dir(const char* dir);
+static void			delete_dir(const char* dir);
 static FILE*		open_file(const char* path, file_mode mode);
 static uint32_t		get_file_size(FILE* f);
 static void			handle_error(const char* format, ...);
+noreturn static void	report_error(const char* prefix, const char* format, va_list args);
+static void			set_error_context(error_context* ctx);
+static error_context*	get_error_context(void);
+static void			push_error_cleanup(cleanup_function* function, void* data);
+static void			pop_error_cleanup(void* data);
+static uint32_t		get_core_count(void);
+static uint32_t		atomic_load_u32(volatile uint32_t* value);
+static void			atomic_store_u32(volatile uint32_t* value, uint32_t new_value);
+static void			lock_mutex(mutex* m);
+static void			unlock_mutex(mutex* m);
+static uint64_t		get_time_ns(void);
+static uint64_t		get_peak_rss(void);
+#if defined(CPU_X64)
+static bool			cpu_has_pclmulqdq(void);
+#endif
+static void			run_jobs(job_function* function, void* data, uint32_t count);
+static bool			is_running_job(void);
 static const char*	generate_path(const char* format, ...);
-static void			print_tabs(FILE* f, int depth);
-static void			print_en_dash(FILE* f);
-static void			print_em_dash(FILE* f);
-static void			print_apostrophe(FILE* f);
-static void			print_quote_level_1_begin(FILE* f);
-static void			print_quote_level_1_end(FILE* f);
-static void			print_char(FILE* f, char c);
-static void			print_simple_text(FILE* f, const char* text);
\ No newline at end of file
+static void*		arena_alloc(arena* a, size_t size);
+static void*		arena_grow(arena* a, void* data, size_t old_size, size_t new_size);
+static char*		arena_format(arena* a, const char* format, ...);
+static arena_mark	arena_get_mark(const arena* a);
+static void			arena_restore(arena* a, arena_mark mark);
+static void			arena_reset(arena* a);
+static void			arena_free(arena* a);
+static arena*		get_document_arena(void);
+static arena*		get_scratch_arena(void);
+static char*		reserve_output(output_buffer* out, uint32_t size);
+static void			add_bytes_written(uint64_t size);
+static uint64_t		get_bytes_written(void);
+static void			write_output(output_buffer* out, const char* dir, const char* filename);
+static void			free_output_buffer(void* out);
+static void			print_bytes(output_buffer* out, const char* data, uint32_t size);
+static void			print_string(output_buffer* out, const char* string);
+static void			print_format(output_buffer* out, const char* format, ...);
+static void			print_tabs(output_buffer* out, int depth);
+static void			print_en_dash(output_buffer* out);
+static void			print_em_dash(output_buffer* out);
+static void			print_apostrophe(output_buffer* out);
+static void			print_quote_level_1_begin(output_buffer* out);
+static void			print_quote_level_1_end(output_buffer* out);
+static void			print_char(output_buffer* out, char c);
+static void			print_json_string(FILE* f, const char* string);
\ No newline at end of file
@@ -1,239 +1,341 @@
+/*
+	Validation checks the line tokens against the document structure rules and builds the final
+	document in the same pass, so the token array is only traversed once. Chapters, element types,
+	text spans and references are stored in growable arrays in the document arena; each chapter
+	records counts while building, and its pointers into the shared arrays are assigned once the
+	final addresses are known.
+*/
 typedef struct
 {
-	line_token*	tokens;
-	uint32_t	line;
-	uint32_t	current;
-	uint32_t	token_count;
-	uint32_t	chapter_count;
-	uint32_t	element_count;
-	uint32_t	reference_count;
+	const line_tokens*	tokens;
+	document*			doc;
+	arena*				memory;
+	document_chapter*	chapters;
+	uint8_t*			element_types;
+	uint32_t*			text_spans;
+	document_reference*	references;
+	document_chapter*	current_chapter;
+	uint32_t			current;
+	uint32_t			chapter_count;
+	uint32_t			element_count;
+	uint32_t			text_count;
+	uint32_t			reference_count;
+	uint32_t			chapter_capacity;
+	uint32_t			element_capacity;
+	uint32_t			text_capacity;
+	uint32_t			reference_capacity;
+	bool				paragraph_break;
 } validate_context;
 
 static void handle_validate_error(validate_context* ctx, const char* format, ...)
 {
-	fprintf(stderr, "Parsing error (line %u): ", ctx->line);
+	// Source lines are only looked up here, for the last token read
+	assert(ctx->current);
+	const uint32_t line = ctx->tokens->lines[ctx->current - 1];
+
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "Parsing error (line %u): ", line);
 
 	va_list args;
 	va_start(args, format);
-	vfprintf(stderr, format, args);
-	va_end(args);
+	report_error(prefix, format, args);
+}
+
+static void* validate_grow_array(validate_context* ctx, void* data, uint32_t* capacity, uint32_t count, size_t element_size)
+{
+	if (count < *capacity)
+		return data;
 
-	fputc('\n', stderr);
+	const uint32_t old_capacity = *capacity;
+	*capacity = old_capacity ? old_capacity * 2 : 16;
 
-	assert(false);
-	exit(EXIT_FAILURE);
+	return arena_grow(ctx->memory, data, old_capacity * element_size, *capacity * element_size);
 }
 
-static line_token* validate_get_next_token(validate_context* ctx)
+static line_token_type validate_get_next_token(validate_context* ctx)
 {
-	assert(ctx->current < ctx->token_count);
+	assert(ctx->current < ctx->tokens->count);
 
-	line_token* token = &ctx->tokens[ctx->current++];
-	ctx->line = token->line;
+	return ctx->tokens->types[ctx->current++];
+}
 
-	return token;
+static void validate_add_element(validate_context* ctx, document_element_type type)
+{
+	assert(!is_text_element(type));
+
+	ctx->element_types = validate_grow_array(ctx, ctx->element_types, &ctx->element_capacity, ctx->element_count, sizeof(uint8_t));
+	ctx->element_types[ctx->element_count++] = (uint8_t)type;
+
+	++ctx->current_chapter->element_count;
 }
 
-static line_token* validate_paragraph(validate_context* ctx, line_token* token)
+// Adds an element carrying the text of the last token read
+static void validate_add_text_element(validate_context* ctx, document_element_type type)
 {
-	ctx->element_count += 3;
+	assert(is_text_element(type));
 
-	token = validate_get_next_token(ctx);
-	while (token->type == line_token_type_paragraph)
+	ctx->element_types = validate_grow_array(ctx, ctx->element_types, &ctx->element_capacity, ctx->element_count, sizeof(uint8_t));
+	ctx->element_types[ctx->element_count++] = (uint8_t)type;
+
+	ctx->text_spans = validate_grow_array(ctx, ctx->text_spans, &ctx->text_capacity, ctx->text_count, sizeof(uint32_t));
+	ctx->text_spans[ctx->text_count++] = ctx->tokens->span_indices[ctx->current - 1];
+
+	++ctx->current_chapter->element_count;
+	++ctx->current_chapter->text_count;
+}
+
+static void validate_add_text_lines(validate_context* ctx, line_token_type token)
+{
+	validate_add_text_element(ctx, document_element_type_text_block);
+
+	const line_token_type type = token;
+
+	// Subsequent lines of the same type are joined with line breaks
+	while (ctx->tokens->types[ctx->current] == type)
 	{
-		ctx->element_count += 2;
 		token = validate_get_next_token(ctx);
+		validate_add_element(ctx, document_element_type_line_break);
+		validate_add_text_element(ctx, document_element_type_text_block);
 	}
+}
 
-	if (token->type != line_token_type_newline)
+static line_token_type validate_paragraph(validate_context* ctx, line_token_type token)
+{
+	const document_element_type begin_type = ctx->paragraph_break ? document_element_type_paragraph_break_begin : document_element_type_paragraph_begin;
+	ctx->paragraph_break = false;
+
+	validate_add_element(ctx, begin_type);
+	validate_add_text_lines(ctx, token);
+	validate_add_element(ctx, document_element_type_paragraph_end);
+
+	token = validate_get_next_token(ctx);
+	if (token != line_token_type_newline)
 		handle_validate_error(ctx, "Paragraphs must be followed by a blank line.");
 
 	token = validate_get_next_token(ctx);
-	if (token->type == line_token_type_newline)
+	if (token == line_token_type_newline)
 	{
-		line_token* break_token = token;
-
 		do
 		{
 			token = validate_get_next_token(ctx);
-		} while (token->type == line_token_type_newline);
+		} while (token == line_token_type_newline);
 
-		if (token->type == line_token_type_paragraph)
-			break_token->type = line_token_type_paragraph_break;
+		// Multiple blank lines between paragraphs create a paragraph break
+		if (token == line_token_type_paragraph)
+			ctx->paragraph_break = true;
 	}
 
 	return token;
 }
 
-static line_token* validate_heading(validate_context* ctx, line_token* token)
+static line_token_type validate_heading(validate_context* ctx, line_token_type token)
 {
-	const int level = token->type - line_token_type_heading_1;
+	const int level = token - line_token_type_heading_1;
 	assert(level >= 0);
 	assert(level < 3);
 
-	++ctx->element_count;
-
 	if (level == 0)
-		++ctx->chapter_count;
+	{
+		ctx->chapters = validate_grow_array(ctx, ctx->chapters, &ctx->chapter_capacity, ctx->chapter_count, sizeof(document_chapter));
+
+		document_chapter* chapter = &ctx->chapters[ctx->chapter_count++];
+		chapter->element_types = nullptr;
+		chapter->text_spans = nullptr;
+		chapter->references = nullptr;
+		chapter->element_count = 0;
+		chapter->text_count = 0;
+		chapter->reference_count = 0;
+
+		ctx->current_chapter = chapter;
+	}
+
+	validate_add_text_element(ctx, document_element_type_heading_1 + level);
 
 	token = validate_get_next_token(ctx);
-	if (token->type != line_token_type_newline)
+	if (token != line_token_type_newline)
 		handle_validate_error(ctx, "Headings must be followed by a blank line.");
 
 	return token;
 }
 
-static line_token* validate_reference(validate_context* ctx, line_token* token)
+static line_token_type validate_reference(validate_context* ctx, line_token_type token)
 {
-	++ctx->reference_count;
+	ctx->references = validate_grow_array(ctx, ctx->references, &ctx->reference_capacity, ctx->reference_count, sizeof(document_reference));
+
+	document_reference* reference = &ctx->references[ctx->reference_count++];
+	reference->span = ctx->tokens->span_indices[ctx->current - 1];
 
-	line_token* next = validate_get_next_token(ctx);
-	if (next->type != line_token_type_newline)
+	++ctx->current_chapter->reference_count;
+
+	line_token_type next = validate_get_next_token(ctx);
+	if (next != line_token_type_newline)
 		handle_validate_error(ctx, "References must be followed by a blank line.");
 
 	return next;
 }
 
-static line_token* validate_preformatted(validate_context* ctx, line_token* token)
+static line_token_type validate_preformatted(validate_context* ctx, line_token_type token)
 {
-	++ctx->element_count;
+	validate_add_text_element(ctx, document_element_type_preformatted);
 
-	line_token* next = validate_get_next_token(ctx);
-	if (next->type != line_token_type_newline)
+	line_token_type next = validate_get_next_token(ctx);
+	if (next != line_token_type_newline)
 		handle_validate_error(ctx, "Preformatted blocks must be followed by a blank line.");
 
 	return next;
 }
 
-static line_token* validate_block_newline(validate_context* ctx, line_token* token)
+static line_token_type validate_block_newline(validate_context* ctx, line_token_type token)
 {
-	++ctx->element_count;
-
 	token = validate_get_next_token(ctx);
-	if (token->type != line_token_type_block_paragraph && token->type != line_token_type_block_citation)
+	if (token != line_token_type_block_paragraph && token != line_token_type_block_citation)
 		handle_validate_error(ctx, "Blank lines within block quotes must be followed by an indented paragraph or indented citation \"---\".");
 
 	return token;
 }
 
-static line_token* validate_paragraph_break(validate_context* ctx, line_token* token)
+static line_token_type validate_paragraph_break(validate_context* ctx, line_token_type token)
 {
 	// Skip empty lines
 	token = validate_get_next_token(ctx);
-	while (token->type == line_token_type_newline)
+	while (token == line_token_type_newline)
 		token = validate_get_next_token(ctx);
 
-	if (token->type != line_token_type_paragraph)
+	if (token != line_token_type_paragraph)
 		handle_validate_error(ctx, "[paragraph-break] must be followed by a paragraph.");
 
+	ctx->paragraph_break = true;
+
 	return token;
 }
 
-static line_token* validate_block_paragraph(validate_context* ctx, line_token* token)
+static line_token_type validate_block_paragraph(validate_context* ctx, line_token_type token)
 {
-	ctx->element_count += 2;
+	validate_add_element(ctx, document_element_type_paragraph_begin);
+	validate_add_text_lines(ctx, token);
+	validate_add_element(ctx, document_element_type_paragraph_end);
 
 	token = validate_get_next_token(ctx);
-	if (token->type != line_token_type_block_paragraph && token->type != line_token_type_block_newline && token->type != line_token_type_newline)
+	if (token != line_token_type_block_newline && token != line_token_type_newline)
 		handle_validate_error(ctx, "Block quotes must be followed by a blank indented line.");
 
 	return token;
 }
 
-static line_token* validate_block_citation(validate_context* ctx, line_token* token)
+static line_token_type validate_block_citation(validate_context* ctx, line_token_type token)
 {
-	/*
-		NOTE: No need to increase element count as we will be appropriating the one added by the
-		previous new line.
-	*/
+	validate_add_text_element(ctx, document_element_type_blockquote_citation);
 
 	token = validate_get_next_token(ctx);
-	if (token->type != line_token_type_newline)
+	if (token != line_token_type_newline)
 		handle_validate_error(ctx, "Block quote citations must be followed by a blank unindented line.");
 
 	return token;
 }
 
-static line_token* validate_blockquote(validate_context* ctx, line_token* token)
+static line_token_type validate_blockquote(validate_context* ctx, line_token_type token)
 {
-	ctx->element_count += 5;
+	validate_add_element(ctx, document_element_type_blockquote_begin);
 
-	token = validate_get_next_token(ctx);
 	for (;;)
 	{
-		if (token->type == line_token_type_block_newline)
+		if (token == line_token_type_block_newline)
 			token = validate_block_newline(ctx, token);
-		else if (token->type == line_token_type_block_paragraph)
+		else if (token == line_token_type_block_paragraph)
 			token = validate_block_paragraph(ctx, token);
-		else if (token->type == line_token_type_block_citation)
+		else if (token == line_token_type_block_citation)
 			token = validate_block_citation(ctx, token);
-		else if (token->type == line_token_type_newline)
+		else if (token == line_token_type_newline)
 			break;
 		else
 			assert(false);
 	}
 
+	validate_add_element(ctx, document_element_type_blockquote_end);
+
 	return token;
 }
 
-static line_token* validate_ordered_list(validate_context* ctx, line_token* token, line_token_type type)
+static line_token_type validate_list(validate_context* ctx, line_token_type token, document_element_type begin_type, document_element_type end_type)
 {
-	ctx->element_count += 3;
+	const line_token_type type = token;
+
+	validate_add_element(ctx, begin_type);
+	validate_add_text_element(ctx, document_element_type_list_item);
 
 	token = validate_get_next_token(ctx);
-	while (token->type == type)
+	while (token == type)
 	{
-		++ctx->element_count;
+		validate_add_text_element(ctx, document_element_type_list_item);
 		token = validate_get_next_token(ctx);
 	}
 
-	if (token->type != line_token_type_newline)
+	validate_add_element(ctx, end_type);
+
+	if (token != line_token_type_newline)
 		handle_validate_error(ctx, "List items must be followed by a blank line.");
 
 	return token;
 }
 
-static line_token* validate_unordered_list(validate_context* ctx, line_token* token)
+static void validate_finish(validate_context* ctx)
 {
-	ctx->element_count += 3;
+	const uint8_t* element_types = ctx->element_types;
+	const uint32_t* text_spans = ctx->text_spans;
+	document_reference* references = ctx->references;
 
-	token = validate_get_next_token(ctx);
-	while (token->type == line_token_type_unordered_list)
+	// Chapters are contiguous in the shared arrays, so assign pointers from the running counts
+	for (uint32_t i = 0; i < ctx->chapter_count; ++i)
 	{
-		++ctx->element_count;
-		token = validate_get_next_token(ctx);
-	}
+		document_chapter* chapter = &ctx->chapters[i];
 
-	if (token->type != line_token_type_newline)
-		handle_validate_error(ctx, "List items must be followed by a blank line.");
+		chapter->element_types = element_types;
+		chapter->text_spans = text_spans;
+		chapter->references = references;
 
-	return token;
+		element_types += chapter->element_count;
+		text_spans += chapter->text_count;
+		references += chapter->reference_count;
+	}
+
+	ctx->doc->chapters = ctx->chapters;
+	ctx->doc->text = ctx->tokens->text;
+	ctx->doc->spans = ctx->tokens->spans;
+	ctx->doc->controls = ctx->tokens->controls;
+	ctx->doc->chapter_count = ctx->chapter_count;
 }
 
-static void validate(line_tokens* tokens, doc_mem_req* out_mem_req)
+static void validate(const line_tokens* tokens, arena* memory, document* out_doc)
 {
 	validate_context ctx = {
-		.tokens			= tokens->lines,
-		.token_count	= tokens->count
+		.tokens			= tokens,
+		.doc			= out_doc,
+		.memory			= memory
 	};
 
-	line_token* token = validate_get_next_token(&ctx);
+	// Most inputs create between one and two elements per token, so this rarely needs to grow
+	ctx.element_capacity = tokens->count + tokens->count / 2;
+	ctx.element_types = arena_alloc(memory, ctx.element_capacity);
+
+	// Each token adds at most one element with text, so this never needs to grow
+	ctx.text_capacity = tokens->count;
+	ctx.text_spans = arena_alloc(memory, sizeof(uint32_t) * ctx.text_capacity);
+
+	line_token_type token = validate_get_next_token(&ctx);
 
 	// For now we require the first printable element to be a top-level heading
-	while (token->type == line_token_type_newline)
+	while (token == line_token_type_newline)
 		token = validate_get_next_token(&ctx);
 
-	if (token->type != line_token_type_heading_1)
+	if (token != line_token_type_heading_1)
 		handle_validate_error(&ctx, "The first printable element must be a top-level heading.");
 
 	for (;;)
 	{
-		switch (token->type)
+		switch (token)
 		{
 		case line_token_type_eof:
-			out_mem_req->chapter_count = ctx.chapter_count;
-			out_mem_req->element_count = ctx.element_count;
-			out_mem_req->reference_count = ctx.reference_count;
+			validate_finish(&ctx);
 			return;
 		case line_token_type_paragraph:
 			token = validate_paragraph(&ctx, token);
@@ -262,18 +364,19 @@ static void validate(line_tokens* tokens, doc_mem_req* out_mem_req)
 			token = validate_paragraph_break(&ctx, token);
 			break;
 		case line_token_type_ordered_list_roman:
-			token = validate_ordered_list(&ctx, token, line_token_type_ordered_list_roman);
+			token = validate_list(&ctx, token, document_element_type_ordered_list_begin_roman, document_element_type_ordered_list_end);
 			break;
 		case line_token_type_ordered_list_arabic:
-			token = validate_ordered_list(&ctx, token, line_token_type_ordered_list_arabic);
+			token = validate_list(&ctx, token, document_element_type_ordered_list_begin_arabic, document_element_type_ordered_list_end);
 			break;
 		case line_token_type_ordered_list_letter:
-			token = validate_ordered_list(&ctx, token, line_token_type_ordered_list_letter);
+			token = validate_list(&ctx, token, document_element_type_ordered_list_begin_letter, document_element_type_ordered_list_end);
 			break;
 		case line_token_type_unordered_list:
-			token = validate_unordered_list(&ctx, token);
+			token = validate_list(&ctx, token, document_element_type_unordered_list_begin, document_element_type_unordered_list_end);
+			break;
 		default:
 			token = validate_get_next_token(&ctx);
 		}
 	}
-}
\ No newline at end of file
+}
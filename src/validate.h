@@ -1,8 +1 @@
-typedef struct
-{
-	uint32_t chapter_count;
-	uint32_t element_count;
-	uint32_t reference_count;
-} doc_mem_req;
-
-static void validate(line_tokens* tokens, doc_mem_req* out_mem_req);
\ No newline at end of file
+static void validate(const line_tokens* tokens, arena* memory, document* out_doc);
\ No newline at end of file
@@ -1,6 +1,14 @@
 // https://pkware.cachefly.net/webdocs/APPNOTE/APPNOTE-6.3.9.TXT
 
 static uint32_t crc32_compute_buffer(uint32_t crc_in, const void* buffer, size_t size);
+static void deflate_compress(output_buffer* out, const uint8_t* data, uint32_t start, uint32_t size, int level, bool final);
+
+enum
+{
+	// Compressed entries are streamed in pieces of this size, keeping the deflate window between them
+	zip_piece_size		= 1 << 20,
+	zip_history_size	= 1 << 15
+};
 
 #pragma pack(push, 1)
 typedef struct
@@ -65,147 +73,408 @@ typedef struct
 #pragma pack(pop)
 static_assert(sizeof(zip_local_file_header) == 30);
 
-void get_dos_date_time(uint16_t* out_date, uint16_t* out_time)
+// Documents in a batch are zipped on several threads, so this avoids gmtime's shared buffer
+static void get_dos_date_time(uint16_t* out_date, uint16_t* out_time)
 {
 	time_t t = time(nullptr);
-	struct tm* gm = gmtime(&t);
+	struct tm gm = {};
+#if defined(_WIN32)
+	gmtime_s(&gm, &t);
+#else
+	gmtime_r(&t, &gm);
+#endif
 
-	int year = gm->tm_year + 80;	// DOS times start from 1980 instead of 1900
+	int year = gm.tm_year + 80;	// DOS times start from 1980 instead of 1900
 
 	uint16_t dos_date = 0;
 	dos_date |= year << 9;			// Bits 9-15
-	dos_date |= gm->tm_mon << 4;	// Bits 5-8
-	dos_date |= gm->tm_mday;		// Bits 0-4
+	dos_date |= gm.tm_mon << 4;	// Bits 5-8
+	dos_date |= gm.tm_mday;		// Bits 0-4
 
 	uint16_t dos_time = 0;
-	dos_time |= gm->tm_hour << 11;	// Bits 11-15
-	dos_time |= gm->tm_min << 5;	// Bits 5-10
-	dos_time |= gm->tm_sec / 2;		// Bits 0-4
+	dos_time |= gm.tm_hour << 11;	// Bits 11-15
+	dos_time |= gm.tm_min << 5;	// Bits 5-10
+	dos_time |= gm.tm_sec / 2;	// Bits 0-4
 
 	*out_date = dos_date;
 	*out_time = dos_time;
 }
 
-static void generate_zip(const char* filepath, const char** input_files, const char** output_files, uint32_t count)
+static void zip_write_bytes(zip_writer* zip, const void* data, uint32_t size)
+{
+	if ((uint64_t)zip->offset + size >= UINT32_MAX)
+		handle_error("Output \"%s\" too large.", zip->filepath);
+
+	fwrite(data, 1, size, zip->f);
+	zip->offset += size;
+}
+
+static void zip_write_local_header(zip_writer* zip, zip_entry* entry)
+{
+	entry->local_header_offset = zip->offset;
+
+	zip_local_file_header local = {
+		.signature			= { 0x50, 0x4B, 0x03, 0x04 },
+		.version			= 0x0014,	// Version 2.0
+		.compression_type	= entry->compression_type,
+		.last_file_time		= zip->time,
+		.last_file_date		= zip->date,
+		.crc32				= entry->crc32,
+		.compressed_size	= entry->compressed_size,
+		.uncompressed_size	= entry->size,
+		.filename_len		= entry->filename_len,
+		.extra_field_len	= 0x0000
+	};
+
+	zip_write_bytes(zip, &local, sizeof(local));
+	zip_write_bytes(zip, entry->filename, entry->filename_len);
+}
+
+static void zip_compress_pending_entry(void* data, uint32_t index)
+{
+	zip_writer* zip = data;
+	zip_pending_entry* pending = &zip->pending[index];
+
+	const uint64_t trace_start = trace_begin();
+
+	pending->compressed.size = 0;
+	deflate_compress(&pending->compressed, (const uint8_t*)pending->data.data, 0, pending->data.size, zip->level, true);
+
+	trace_end("zip_compress", zip->entries[pending->entry_index].filename, trace_start, pending->data.size);
+}
+
+/*
+	Compresses the pending entries in parallel, then writes them out in the order they were added.
+	Entries that don't get any smaller are stored instead.
+*/
+static void zip_flush_pending(zip_writer* zip)
+{
+	if (zip->pending_count == 0)
+		return;
+
+	run_jobs(zip_compress_pending_entry, zip, zip->pending_count);
+
+	const uint64_t trace_start = trace_begin();
+	const uint32_t start_offset = zip->offset;
+
+	for (uint32_t i = 0; i < zip->pending_count; ++i)
+	{
+		zip_pending_entry* pending = &zip->pending[i];
+		zip_entry* entry = &zip->entries[pending->entry_index];
+
+		const output_buffer* contents = &pending->compressed;
+		if (pending->compressed.size >= pending->data.size)
+		{
+			contents = &pending->data;
+			entry->compression_type = zip_compression_store;
+		}
+
+		entry->compressed_size = contents->size;
+
+		zip_write_local_header(zip, entry);
+		zip_write_bytes(zip, contents->data, contents->size);
+
+		// Keep the allocations so later entries can reuse them
+		pending->data.size = 0;
+	}
+
+	trace_end("zip_flush", zip->filepath, trace_start, zip->offset - start_offset);
+
+	zip->pending_count = 0;
+}
+
+static void zip_free_pending(zip_writer* zip)
+{
+	if (!zip->pending)
+		return;
+
+	for (uint32_t i = 0; i < zip->pending_capacity; ++i)
+	{
+		mem_free(zip->pending[i].data.data);
+		mem_free(zip->pending[i].compressed.data);
+	}
+
+	mem_free(zip->pending);
+	zip->pending = nullptr;
+	zip->pending_capacity = 0;
+}
+
+// Releases the pending buffers and closes the file if an error ends the archive early
+static void zip_abort(void* data)
+{
+	zip_writer* zip = data;
+	zip_free_pending(zip);
+
+	if (zip->f)
+	{
+		fclose(zip->f);
+		zip->f = nullptr;
+	}
+}
+
+/*
+	Entry names and records are allocated from memory, which must outlive the writer. Pending
+	buffers are heap allocations reused by every entry and freed when the archive ends.
+*/
+static void zip_begin(zip_writer* zip, arena* memory, const char* filepath, int level)
+{
+	assert(level >= 0 && level <= 9);
+
+	*zip = (zip_writer){
+		.filepath	= filepath,
+		.f			= open_file(filepath, file_mode_write),
+		.memory		= memory,
+		.level		= level
+	};
+
+	get_dos_date_time(&zip->date, &zip->time);
+	push_error_cleanup(zip_abort, zip);
+
+	// Limit how many entries are held in memory while waiting to be compressed together
+	zip->pending_capacity = get_core_count();
+	zip->pending = mem_calloc(zip->pending_capacity, sizeof(zip_pending_entry));
+}
+
+static void zip_begin_entry(zip_writer* zip, const char* filename, zip_compression compression)
+{
+	assert(!zip->in_entry);
+
+	const size_t filename_len = strlen(filename);
+	assert(filename_len <= UINT16_MAX);
+
+	if (zip->entry_count == zip->entry_capacity)
+	{
+		const uint32_t old_capacity = zip->entry_capacity;
+		zip->entry_capacity = old_capacity ? old_capacity * 2 : 16;
+		zip->entries = arena_grow(zip->memory, zip->entries, sizeof(zip_entry) * old_capacity, sizeof(zip_entry) * zip->entry_capacity);
+	}
+
+	char* name = arena_alloc(zip->memory, filename_len + 1);
+	memcpy(name, filename, filename_len + 1);
+
+	if (zip->level == 0)
+		compression = zip_compression_store;
+
+	zip_entry* entry = &zip->entries[zip->entry_count++];
+	entry->filename			= name;
+	entry->filename_len		= (uint16_t)filename_len;
+	entry->compression_type	= compression;
+	entry->crc32			= 0;
+	entry->size				= 0;
+	entry->compressed_size	= 0;
+
+	if (compression == zip_compression_deflate)
+	{
+		// Compressed entries are collected in memory and written once they have been compressed
+		if (zip->pending_count == zip->pending_capacity)
+			zip_flush_pending(zip);
+
+		zip->pending[zip->pending_count++].entry_index = zip->entry_count - 1;
+	}
+	else
+	{
+		// Stored entries stream straight to the file, so anything pending has to be written first
+		zip_flush_pending(zip);
+
+		// The CRC and sizes aren't known yet, so they are filled in by zip_end_entry
+		zip_write_local_header(zip, entry);
+	}
+
+	zip->entry_trace_start = trace_begin();
+	zip->in_entry = true;
+}
+
+// Seeks back to fill in the local header fields that depend on the content
+static void zip_patch_local_header(zip_writer* zip, const zip_entry* entry)
 {
-	// Cache string lengths
-	uint16_t* filename_lengths = malloc(sizeof(uint16_t) * count);
-	for (uint32_t i = 0; i < count; ++i)
-		filename_lengths[i] = (uint16_t)strlen(output_files[i]);
+	const uint32_t fields[3] = { entry->crc32, entry->compressed_size, entry->size };
+	fseek(zip->f, entry->local_header_offset + offsetof(zip_local_file_header, crc32), SEEK_SET);
+	fwrite(fields, sizeof(fields), 1, zip->f);
+	fseek(zip->f, zip->offset, SEEK_SET);
+}
 
-	// Open files and cache sizes
-	FILE** file_handles = malloc(sizeof(FILE*) * count);
-	uint32_t* file_sizes = malloc(sizeof(uint32_t) * count);
-	for (uint32_t i = 0; i < count; ++i)
+/*
+	Compresses what has been written to the current entry since the last piece and writes it to
+	the file, so memory is bounded by the piece size rather than the entry. The first piece writes
+	out the entries pending before it, then a header whose sizes are patched when the entry ends.
+*/
+static void zip_write_piece(zip_writer* zip, bool final)
+{
+	const uint32_t index = zip->pending_count - 1;
+	zip_pending_entry* pending = &zip->pending[index];
+	zip_entry* entry = &zip->entries[pending->entry_index];
+
+	if (!pending->streamed)
 	{
-		file_handles[i] = open_file(input_files[i], file_mode_read);
-		file_sizes[i] = get_file_size(file_handles[i]);
+		zip->pending_count = index;
+		zip_flush_pending(zip);
+
+		// Move the entry to the first slot, swapping buffers so none are lost
+		const zip_pending_entry first = zip->pending[0];
+		zip->pending[0] = *pending;
+		*pending = first;
+
+		pending = &zip->pending[0];
+		pending->streamed = true;
+		zip->pending_count = 1;
+
+		zip_write_local_header(zip, entry);
 	}
 
-	// Calculate zip file size
-	uint64_t zip_size = 0;
+	const uint64_t trace_start = trace_begin();
+	output_buffer* data = &pending->data;
+
+	pending->compressed.size = 0;
+	deflate_compress(&pending->compressed, (const uint8_t*)data->data, pending->history_size, data->size, zip->level, final);
+
+	zip_write_bytes(zip, pending->compressed.data, pending->compressed.size);
+	entry->compressed_size += pending->compressed.size;
 
-	// Single end of central directory record
-	zip_size += sizeof(zip_end_of_central_directory_record);
+	trace_end("zip_compress", entry->filename, trace_start, data->size - pending->history_size);
 
-	// The rest of the size depends on the file count, names, and content
-	for (uint32_t i = 0; i < count; ++i)
+	if (final)
 	{
-		zip_size += sizeof(zip_local_file_header);
-		zip_size += sizeof(zip_central_directory_header);
-		zip_size += (filename_lengths[i] * 2);
-		zip_size += file_sizes[i];
+		data->size = 0;
+		pending->history_size = 0;
+		pending->streamed = false;
+		zip->pending_count = 0;
+		return;
 	}
 
-	// Make sure it isn't too big
-	if (zip_size >= UINT32_MAX)
-		handle_error("Output \"%s\" too large.", filepath);
+	// Keep the end of the piece so the next one can still match against it
+	const uint32_t history_size = data->size < zip_history_size ? data->size : zip_history_size;
+	memmove(data->data, data->data + data->size - history_size, history_size);
+	data->size = history_size;
+	pending->history_size = history_size;
+}
 
-	// Allocate space for entire zip file
-	uint8_t* zip_data = malloc(zip_size);
+static void zip_write(zip_writer* zip, const void* data, uint32_t size)
+{
+	assert(zip->in_entry);
 
-	// Get time and date
-	uint16_t date;
-	uint16_t time;
-	get_dos_date_time(&date, &time);
+	zip_entry* entry = &zip->entries[zip->entry_count - 1];
+	entry->crc32 = crc32_compute_buffer(entry->crc32, data, size);
+	entry->size += size;
 
-	uint16_t central_directory_size = 0;
-	for (uint32_t i = 0; i < count; ++i)
+	if (entry->compression_type == zip_compression_store)
 	{
-		central_directory_size += sizeof(zip_central_directory_header);
-		central_directory_size += filename_lengths[i];
+		entry->compressed_size += size;
+		zip_write_bytes(zip, data, size);
+		return;
 	}
 
-	uint8_t* current_data = zip_data;
-	zip_end_of_central_directory_record* ecdr = (zip_end_of_central_directory_record*)(zip_data + zip_size - sizeof(zip_end_of_central_directory_record));
-	zip_central_directory_header* current_dir = (zip_central_directory_header*)((uint8_t*)ecdr - central_directory_size);
-
-	ecdr->signature[0]					= 0x50;
-	ecdr->signature[1]					= 0x4B;
-	ecdr->signature[2]					= 0x05;
-	ecdr->signature[3]					= 0x06;
-	ecdr->disk_index					= 0x0000;
-	ecdr->central_directory_disk_index	= 0x0000;
-	ecdr->disk_entry_count				= count;
-	ecdr->total_entry_count				= count;
-	ecdr->central_directory_size		= central_directory_size;
-	ecdr->offset						= (uint32_t)((uint8_t*)current_dir - zip_data);
-
-	for (uint32_t i = 0; i < count; ++i)
+	const char* bytes = data;
+	while (size)
 	{
-		zip_local_file_header* local = (zip_local_file_header*)current_data;
-		current_data += sizeof(zip_local_file_header);
-
-		// File path directory follows header
-		memcpy(current_data, output_files[i], filename_lengths[i]);
-		current_data += filename_lengths[i];
-
-		// Read file and calculate CRC32 from memory
-		fread(current_data, 1, file_sizes[i], file_handles[i]);
-		const uint32_t crc = crc32_compute_buffer(0, current_data, file_sizes[i]);
-		current_data += file_sizes[i];
-
-		local->signature[0]			= 0x50;
-		local->signature[1]			= 0x4B;
-		local->signature[2]			= 0x03;
-		local->signature[3]			= 0x04;
-		local->version				= 0x0014;	// Version 2.0
-		local->compression_type		= 0x0000;	// No Compression
-		local->last_file_time		= time;
-		local->last_file_date		= date;
-		local->crc32				= crc;
-		local->compressed_size		= file_sizes[i];
-		local->uncompressed_size	= file_sizes[i];
-		local->filename_len			= filename_lengths[i];
-		local->extra_field_len		= 0x0000;
-
-		current_dir->signature[0]				= 0x50;
-		current_dir->signature[1]				= 0x4B;
-		current_dir->signature[2]				= 0x01;
-		current_dir->signature[3]				= 0x02;
-		current_dir->version_made_by			= 0x0014;
-		current_dir->version_needed_to_extract	= 0x0014;
-		current_dir->flags						= 0x0000;
-		current_dir->compression_type			= 0x0000;
-		current_dir->last_file_time				= time;
-		current_dir->last_file_date				= date;
-		current_dir->crc32						= crc;
-		current_dir->compressed_size			= file_sizes[i];
-		current_dir->uncompressed_size			= file_sizes[i];
-		current_dir->filename_len				= filename_lengths[i];
-		current_dir->extra_field_len			= 0x0000;
-		current_dir->comment_len				= 0x0000;
-		current_dir->disk_number_start			= 0x0000;
-		current_dir->internal_file_attributes	= 0x0001;
-		current_dir->external_file_attributes	= 0x00000020;
-		current_dir->local_header_offset		= (uint32_t)((uint8_t*)local - zip_data);
-		memcpy(current_dir + 1, output_files[i], filename_lengths[i]);
-
-		current_dir = (zip_central_directory_header*)((uint8_t*)current_dir + sizeof(zip_central_directory_header) + filename_lengths[i]);
+		zip_pending_entry* pending = &zip->pending[zip->pending_count - 1];
+		const uint32_t space = zip_piece_size - (pending->data.size - pending->history_size);
+		const uint32_t count = size < space ? size : space;
+
+		print_bytes(&pending->data, bytes, count);
+		bytes += count;
+		size -= count;
+
+		if (count == space)
+			zip_write_piece(zip, false);
 	}
+}
+
+static void zip_end_entry(zip_writer* zip)
+{
+	assert(zip->in_entry);
 
-	// Write out entire file
-	FILE* zip_file = open_file(filepath, file_mode_write);
-	fwrite(zip_data, zip_size, 1, zip_file);
-	fclose(zip_file);
-}
\ No newline at end of file
+	const zip_entry* entry = &zip->entries[zip->entry_count - 1];
+
+	if (entry->compression_type == zip_compression_store)
+	{
+		zip_patch_local_header(zip, entry);
+	}
+	else if (zip->pending[zip->pending_count - 1].streamed)
+	{
+		zip_write_piece(zip, true);
+		zip_patch_local_header(zip, entry);
+	}
+
+	trace_end("zip_entry", entry->filename, zip->entry_trace_start, entry->size);
+
+	zip->in_entry = false;
+}
+
+static void zip_write_buffer(zip_writer* zip, output_buffer* out)
+{
+	zip_write(zip, out->data, out->size);
+
+	// Keep the allocation so the next write can reuse it
+	out->size = 0;
+}
+
+static void zip_write_output(zip_writer* zip, output_buffer* out, const char* filename, zip_compression compression)
+{
+	zip_begin_entry(zip, filename, compression);
+	zip_write_buffer(zip, out);
+	zip_end_entry(zip);
+}
+
+static void zip_end(zip_writer* zip)
+{
+	assert(!zip->in_entry);
+
+	zip_flush_pending(zip);
+	zip_free_pending(zip);
+
+	if (zip->entry_count > UINT16_MAX)
+		handle_error("Output \"%s\" has too many files.", zip->filepath);
+
+	const uint32_t central_directory_offset = zip->offset;
+
+	for (uint32_t i = 0; i < zip->entry_count; ++i)
+	{
+		const zip_entry* entry = &zip->entries[i];
+
+		zip_central_directory_header header = {
+			.signature					= { 0x50, 0x4B, 0x01, 0x02 },
+			.version_made_by			= 0x0014,
+			.version_needed_to_extract	= 0x0014,
+			.flags						= 0x0000,
+			.compression_type			= entry->compression_type,
+			.last_file_time				= zip->time,
+			.last_file_date				= zip->date,
+			.crc32						= entry->crc32,
+			.compressed_size			= entry->compressed_size,
+			.uncompressed_size			= entry->size,
+			.filename_len				= entry->filename_len,
+			.extra_field_len			= 0x0000,
+			.comment_len				= 0x0000,
+			.disk_number_start			= 0x0000,
+			.internal_file_attributes	= 0x0001,
+			.external_file_attributes	= 0x00000020,
+			.local_header_offset		= entry->local_header_offset
+		};
+
+		zip_write_bytes(zip, &header, sizeof(header));
+		zip_write_bytes(zip, entry->filename, entry->filename_len);
+	}
+
+	zip_end_of_central_directory_record ecdr = {
+		.signature						= { 0x50, 0x4B, 0x05, 0x06 },
+		.disk_index						= 0x0000,
+		.central_directory_disk_index	= 0x0000,
+		.disk_entry_count				= (uint16_t)zip->entry_count,
+		.total_entry_count				= (uint16_t)zip->entry_count,
+		.central_directory_size			= zip->offset - central_directory_offset,
+		.offset							= central_directory_offset,
+		.comment_len					= 0x0000
+	};
+
+	zip_write_bytes(zip, &ecdr, sizeof(ecdr));
+
+	const bool failed = ferror(zip->f);
+	fclose(zip->f);
+	zip->f = nullptr;
+	pop_error_cleanup(zip);
+
+	if (failed)
+		handle_error("Unable to write file \"%s\".", zip->filepath);
+
+	add_bytes_written(zip->offset);
+}
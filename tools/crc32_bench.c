@@ -0,0 +1,112 @@
+/*
+	Micro-benchmark for the CRC-32 implementations used by the zip writer. Checks every variant
+	gives the same result as the classic byte-at-a-time loop, then reports throughput for each.
+	Usage: crc32_bench [size in KB] [iterations]
+*/
+#include "../src/press.h"
+#include "../src/util.h"
+#include "../src/document.h"
+#include "../src/tokenise.h"
+
+#include "../src/util.c"
+#include "../src/crc32.c"
+
+typedef uint32_t crc32_function(uint32_t crc, const uint8_t* data, size_t size);
+
+static uint32_t crc32_bench_bytes(uint32_t crc, const uint8_t* data, size_t size)
+{
+	return crc32_update_bytes(crc ^ 0xFFFFFFFF, data, size) ^ 0xFFFFFFFF;
+}
+
+static uint32_t crc32_bench_slice16(uint32_t crc, const uint8_t* data, size_t size)
+{
+	return crc32_update_slice16(crc ^ 0xFFFFFFFF, data, size) ^ 0xFFFFFFFF;
+}
+
+static uint32_t crc32_bench_dispatch(uint32_t crc, const uint8_t* data, size_t size)
+{
+	return crc32_compute_buffer(crc, data, size);
+}
+
+typedef struct
+{
+	const char*		name;
+	crc32_function*	function;
+} crc32_variant;
+
+static const crc32_variant variants[] = {
+	{ "bytes",		crc32_bench_bytes },
+	{ "slice16",	crc32_bench_slice16 },
+	{ "dispatch",	crc32_bench_dispatch }
+};
+
+enum
+{
+	variant_count = sizeof(variants) / sizeof(variants[0])
+};
+
+static void check_variants(const uint8_t* data, size_t size)
+{
+	// Cover every alignment and tail length, plus incremental updates split at awkward points
+	for (size_t offset = 0; offset < 16; ++offset)
+	{
+		for (size_t len = 0; len < 300 && offset + len <= size; ++len)
+		{
+			const uint32_t expected = crc32_bench_bytes(0, data + offset, len);
+
+			for (int i = 1; i < variant_count; ++i)
+			{
+				if (variants[i].function(0, data + offset, len) != expected)
+					handle_error("%s differs for offset %zu, size %zu.", variants[i].name, offset, len);
+			}
+		}
+	}
+
+	const uint32_t expected = crc32_bench_bytes(0, data, size);
+	for (int i = 1; i < variant_count; ++i)
+	{
+		const size_t split = size / 3 + 7;
+		const uint32_t first = variants[i].function(0, data, split);
+		if (variants[i].function(first, data + split, size - split) != expected)
+			handle_error("%s differs when split.", variants[i].name);
+	}
+}
+
+int main(int argc, const char** argv)
+{
+	const size_t size = (argc > 1 ? strtoul(argv[1], nullptr, 10) : 1024) << 10;
+	const uint32_t iterations = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 200;
+
+	if (size < 1024 || iterations == 0)
+		handle_error("Usage: crc32_bench [size in KB] [iterations]");
+
+	uint8_t* data = malloc(size);
+	uint32_t seed = 0x12345678;
+	for (size_t i = 0; i < size; ++i)
+	{
+		seed = seed * 1664525 + 1013904223;
+		data[i] = (uint8_t)(seed >> 24);
+	}
+
+	check_variants(data, size);
+
+#if defined(CPU_X64)
+	printf("pclmulqdq: %s\n", cpu_has_pclmulqdq() ? "yes" : "no");
+#endif
+
+	for (int i = 0; i < variant_count; ++i)
+	{
+		uint32_t crc = 0;
+		const uint64_t start = get_time_ns();
+
+		for (uint32_t j = 0; j < iterations; ++j)
+			crc = variants[i].function(crc, data, size);
+
+		const double seconds = (get_time_ns() - start) / 1e9;
+		printf("%-10s %8.2f GB/s  (crc %08X)\n", variants[i].name, (double)size * iterations / seconds / 1e9, crc);
+	}
+
+	free(data);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,408 @@
+/*
+	Benchmark for the whole pipeline. Every source file in a directory is run through each stage a
+	number of times, along with copies enlarged to 10x and 100x by repeating the body of the
+	document. Results are written to stdout as JSON so runs can be compared by scripts, and the
+	allocation report for every call site is printed to stderr on exit.
+	With --counters, hardware performance counters are also read around each stage on Linux. Any
+	counter the kernel or CPU can't provide is reported as null.
+	Usage: press_bench [--counters] [iterations] [source directory]
+*/
+#define PRESS_NO_MAIN
+#define PRESS_TRACK_ALLOCATIONS
+#include "../src/unity.c"
+
+#if defined(__linux__)
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+#endif
+
+typedef enum
+{
+	bench_stage_tokenise,
+	bench_stage_validate,
+	bench_stage_generate_html,
+	bench_stage_generate_epub,
+	bench_stage_generate_odt,
+	bench_stage_crc32,
+	bench_stage_count
+} bench_stage;
+
+static const char* const bench_stage_names[bench_stage_count] = {
+	"tokenise",
+	"validate",
+	"generate_html",
+	"generate_epub",
+	"generate_odt",
+	"crc32"
+};
+
+typedef enum
+{
+	bench_counter_cycles,
+	bench_counter_instructions,
+	bench_counter_branch_misses,
+	bench_counter_l1d_misses,
+	bench_counter_llc_misses,
+	bench_counter_count
+} bench_counter;
+
+static const char* const bench_counter_names[bench_counter_count] = {
+	"cycles",
+	"instructions",
+	"branch_misses",
+	"l1d_misses",
+	"llc_misses"
+};
+
+typedef struct
+{
+	uint64_t	best_ns;
+	uint64_t	total_ns;
+	uint64_t	allocations;
+	uint64_t	allocated_bytes;
+	uint64_t	counters[bench_counter_count];
+} bench_result;
+
+typedef struct
+{
+	uint64_t	start_ns;
+	uint64_t	start_allocations;
+	uint64_t	start_bytes;
+	uint64_t	start_counters[bench_counter_count];
+} bench_timer;
+
+enum
+{
+	bench_level = 6
+};
+
+static const uint32_t bench_scales[] = { 1, 10, 100 };
+
+// File descriptors of open counters, or -1 where the counter isn't available
+static int bench_counter_fds[bench_counter_count];
+static bool bench_counters_enabled;
+
+#if defined(__linux__)
+static int open_counter(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr = {
+		.size			= sizeof(attr),
+		.type			= type,
+		.config			= config,
+		.read_format	= PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+		.exclude_kernel	= 1,
+		.exclude_hv		= 1,
+		.inherit		= 1		// Include the worker threads that compress zip entries
+	};
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void open_counters(void)
+{
+	bench_counters_enabled = true;
+
+	for (int i = 0; i < bench_counter_count; ++i)
+		bench_counter_fds[i] = -1;
+
+#if defined(__linux__)
+	const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+	bench_counter_fds[bench_counter_cycles] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	bench_counter_fds[bench_counter_instructions] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	bench_counter_fds[bench_counter_branch_misses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	bench_counter_fds[bench_counter_l1d_misses] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_read_miss);
+	bench_counter_fds[bench_counter_llc_misses] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_read_miss);
+#endif
+
+	for (int i = 0; i < bench_counter_count; ++i)
+	{
+		if (bench_counter_fds[i] < 0)
+			fprintf(stderr, "Counter \"%s\" is unavailable.\n", bench_counter_names[i]);
+	}
+}
+
+static void read_counters(uint64_t* values)
+{
+	for (int i = 0; i < bench_counter_count; ++i)
+	{
+		values[i] = 0;
+
+#if defined(__linux__)
+		uint64_t data[3];	// Value, time enabled, time running
+		if (bench_counter_fds[i] < 0 || read(bench_counter_fds[i], data, sizeof(data)) != sizeof(data))
+			continue;
+
+		// Scale up when the kernel had to share the hardware counters between events
+		values[i] = data[2] && data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+#endif
+	}
+}
+
+static bench_timer bench_begin_stage(void)
+{
+	bench_timer timer;
+	get_allocation_totals(&timer.start_allocations, &timer.start_bytes);
+	if (bench_counters_enabled)
+		read_counters(timer.start_counters);
+	timer.start_ns = get_time_ns();
+
+	return timer;
+}
+
+static void bench_end_stage(const bench_timer* timer, bench_result* result)
+{
+	const uint64_t elapsed = get_time_ns() - timer->start_ns;
+
+	if (bench_counters_enabled)
+	{
+		uint64_t counters[bench_counter_count];
+		read_counters(counters);
+
+		for (int i = 0; i < bench_counter_count; ++i)
+			result->counters[i] += counters[i] - timer->start_counters[i];
+	}
+
+	uint64_t allocations, allocated_bytes;
+	get_allocation_totals(&allocations, &allocated_bytes);
+
+	if (result->best_ns == 0 || elapsed < result->best_ns)
+		result->best_ns = elapsed;
+
+	result->total_ns += elapsed;
+	result->allocations += allocations - timer->start_allocations;
+	result->allocated_bytes += allocated_bytes - timer->start_bytes;
+}
+
+/*
+	Enlarged sources keep the metadata once and repeat everything from the first top-level heading,
+	separated by a blank line so each copy still validates.
+*/
+static const char* scale_source(const char* text, uint32_t size, uint32_t scale, uint32_t* out_size)
+{
+	if (scale == 1)
+	{
+		*out_size = size;
+		return text;
+	}
+
+	const char* body = text;
+	if (strncmp(text, "# ", 2) != 0)
+	{
+		const char* heading = strstr(text, "\n# ");
+		if (heading)
+			body = heading + 1;
+	}
+
+	const uint64_t body_size = size - (body - text);
+	const uint64_t scaled_size = size + (body_size + 1) * (scale - 1);
+	if (scaled_size >= UINT32_MAX - 2)
+		handle_error("Document is too large to enlarge %u times.", scale);
+
+	char* scaled = mem_alloc(scaled_size + 1);
+	char* write = scaled;
+
+	memcpy(write, text, size);
+	write += size;
+
+	for (uint32_t i = 1; i < scale; ++i)
+	{
+		*write++ = '\n';
+		memcpy(write, body, body_size);
+		write += body_size;
+	}
+
+	*write = 0;
+	*out_size = (uint32_t)scaled_size;
+
+	return scaled;
+}
+
+// Keeps the CRC from being optimised away
+static volatile uint32_t bench_crc32;
+
+static void bench_document(const char* text, uint32_t size, const char* title, const char* dir, uint32_t iterations, bench_result* results)
+{
+	arena* memory = get_document_arena();
+
+	for (uint32_t i = 0; i < iterations; ++i)
+	{
+		// Later iterations reuse the blocks the first one grew, as batch conversion does
+		arena_reset(memory);
+
+		document doc = {};
+		line_tokens tokens;
+
+		bench_timer timer = bench_begin_stage();
+		tokenise(text, size, memory, &tokens, &doc.metadata);
+		bench_end_stage(&timer, &results[bench_stage_tokenise]);
+
+		if (doc.metadata.type == document_type_none)
+			doc.metadata.type = document_type_article;
+
+		timer = bench_begin_stage();
+		validate(&tokens, memory, &doc);
+		bench_end_stage(&timer, &results[bench_stage_validate]);
+
+		if (!doc.metadata.title)
+			doc.metadata.title = title;
+
+		timer = bench_begin_stage();
+		generate_html(&doc, dir);
+		bench_end_stage(&timer, &results[bench_stage_generate_html]);
+
+		timer = bench_begin_stage();
+		generate_epub(&doc, dir, bench_level);
+		bench_end_stage(&timer, &results[bench_stage_generate_epub]);
+
+		timer = bench_begin_stage();
+		generate_odt(&doc, dir, bench_level);
+		bench_end_stage(&timer, &results[bench_stage_generate_odt]);
+
+		timer = bench_begin_stage();
+		bench_crc32 = crc32_compute_buffer(0, (const uint8_t*)text, size);
+		bench_end_stage(&timer, &results[bench_stage_crc32]);
+	}
+}
+
+static void print_counter_ratio(const char* name, int numerator, int denominator, double value)
+{
+	printf(", \"%s\": ", name);
+
+	if (bench_counter_fds[numerator] < 0 || bench_counter_fds[denominator] < 0)
+		printf("null");
+	else
+		printf("%.4f", value);
+}
+
+// Counts are per iteration, with IPC and misses per input byte derived from them
+static void print_counters(const bench_result* result, uint32_t size, uint32_t iterations)
+{
+	printf(", \"counters\": { ");
+
+	for (int i = 0; i < bench_counter_count; ++i)
+	{
+		printf("%s\"%s\": ", i ? ", " : "", bench_counter_names[i]);
+
+		if (bench_counter_fds[i] < 0)
+			printf("null");
+		else
+			printf("%llu", (unsigned long long)(result->counters[i] / iterations));
+	}
+
+	const double bytes = (double)size * iterations;
+	const uint64_t cycles = result->counters[bench_counter_cycles];
+
+	print_counter_ratio("ipc", bench_counter_instructions, bench_counter_cycles, cycles ? (double)result->counters[bench_counter_instructions] / cycles : 0);
+	print_counter_ratio("branch_misses_per_byte", bench_counter_branch_misses, bench_counter_branch_misses, result->counters[bench_counter_branch_misses] / bytes);
+	print_counter_ratio("l1d_misses_per_byte", bench_counter_l1d_misses, bench_counter_l1d_misses, result->counters[bench_counter_l1d_misses] / bytes);
+	print_counter_ratio("llc_misses_per_byte", bench_counter_llc_misses, bench_counter_llc_misses, result->counters[bench_counter_llc_misses] / bytes);
+
+	printf(" }");
+}
+
+static void print_results(const char* name, uint32_t scale, uint32_t size, uint32_t iterations, const bench_result* results)
+{
+	printf("\t\t{\n\t\t\t\"name\": ");
+	print_json_string(stdout, name);
+	printf(",\n\t\t\t\"scale\": %u,\n\t\t\t\"bytes\": %u,\n", scale, size);
+
+	// The operating system only tracks the peak for the whole process, so this includes earlier runs
+	printf("\t\t\t\"peak_rss_bytes\": %llu,\n", (unsigned long long)get_peak_rss());
+	printf("\t\t\t\"stages\": {\n");
+
+	for (int i = 0; i < bench_stage_count; ++i)
+	{
+		const bench_result* result = &results[i];
+		const double mb_per_s = result->best_ns ? size / (result->best_ns / 1e9) / 1e6 : 0;
+
+		printf(
+			"\t\t\t\t\"%s\": { \"best_ns\": %llu, \"mean_ns\": %llu, \"mb_per_s\": %.2f, "
+			"\"allocations\": %llu, \"allocated_bytes\": %llu",
+			bench_stage_names[i],
+			(unsigned long long)result->best_ns,
+			(unsigned long long)(result->total_ns / iterations),
+			mb_per_s,
+			(unsigned long long)(result->allocations / iterations),
+			(unsigned long long)(result->allocated_bytes / iterations)
+		);
+
+		if (bench_counters_enabled)
+			print_counters(result, size, iterations);
+
+		printf(" }%s\n", i + 1 < bench_stage_count ? "," : "");
+	}
+
+	printf("\t\t\t}\n\t\t}");
+}
+
+int main(int argc, const char** argv)
+{
+	uint32_t iterations = 5;
+	const char* source_dir = "doc";
+	int positional_count = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--counters") == 0)
+			open_counters();
+		else if (positional_count++ == 0)
+			iterations = (uint32_t)strtoul(argv[i], nullptr, 10);
+		else
+			source_dir = argv[i];
+	}
+
+	if (iterations == 0 || positional_count > 2)
+		handle_error("Usage: press_bench [--counters] [iterations] [source directory]");
+
+	source_list sources = {};
+	add_sources(&sources, source_dir);
+
+	// Generators write real files so that their cost includes the final write
+	static const char bench_dir[] = "press_bench_output";
+	create_dir(bench_dir);
+
+	printf("{\n\t\"iterations\": %u,\n\t\"level\": %d,\n\t\"counters\": %s,\n\t\"documents\": [\n", iterations, bench_level, bench_counters_enabled ? "true" : "false");
+
+	// Sources and their names are held here, apart from the document arena reset by each iteration
+	arena source_memory = {};
+
+	for (uint32_t i = 0; i < sources.count; ++i)
+	{
+		arena_reset(&source_memory);
+
+		source_file source;
+		load_file(&source_memory, sources.paths[i], &source);
+		const char* text = source.text;
+		const uint32_t size = source.size;
+		const char* name = copy_filename(&source_memory, sources.paths[i]);
+
+		for (uint32_t j = 0; j < sizeof(bench_scales) / sizeof(bench_scales[0]); ++j)
+		{
+			uint32_t scaled_size;
+			const char* scaled = scale_source(text, size, bench_scales[j], &scaled_size);
+
+			bench_result results[bench_stage_count] = {};
+			bench_document(scaled, scaled_size, name, bench_dir, iterations, results);
+
+			if (i || j)
+				printf(",\n");
+			print_results(name, bench_scales[j], scaled_size, iterations, results);
+
+			if (scaled != text)
+				mem_free((void*)scaled);
+
+			fflush(stdout);
+		}
+
+		unload_file(&source);
+	}
+
+	printf("\n\t]\n}\n");
+
+	arena_free(&source_memory);
+	delete_dir(bench_dir);
+
+	return EXIT_SUCCESS;
+}
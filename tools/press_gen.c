@@ -0,0 +1,480 @@
+/*
+	Generates synthetic press sources for scaling and stress tests. The shape of the document is set
+	by the options below, and the output always passes validation so every stage can be measured
+	from a few kilobytes up to gigabytes.
+	Usage: press_gen [options] [out.txt]
+*/
+#include "../src/press.h"
+#include "../src/util.h"
+#include "../src/document.h"
+#include "../src/tokenise.h"
+
+#include "../src/roman_numeral.c"
+#include "../src/util.c"
+
+typedef struct
+{
+	uint64_t	size;
+	uint32_t	chapters;
+	uint32_t	paragraph_words;
+	uint32_t	list_percent;
+	uint32_t	list_items;
+	uint32_t	blockquote_percent;
+	uint32_t	blockquote_paragraphs;
+	uint32_t	reference_percent;
+	uint32_t	utf8_percent;
+	uint32_t	comment_percent;
+	uint32_t	seed;
+	bool		crlf;
+} gen_options;
+
+typedef struct
+{
+	const gen_options*	options;
+	FILE*				f;
+	output_buffer		out;
+	uint64_t			flushed;
+	uint64_t			random;
+	uint32_t			chapter_refs;
+} gen_context;
+
+enum
+{
+	gen_flush_size			= 1 << 20,
+	gen_max_references		= 998,	// Reference numbers must stay below 999
+	gen_max_arabic_items	= 998,
+	gen_max_letter_items	= 26,
+	gen_max_roman_items		= roman_numeral_max
+};
+
+static const char* const ascii_words[] = {
+	"the", "workers", "of", "history", "capital", "labour", "and", "society", "production", "value",
+	"struggle", "class", "material", "conditions", "theory", "practice", "in", "a", "to", "is",
+	"movement", "organisation", "property", "wages", "market", "state", "power", "relations", "of", "ideas"
+};
+
+static const char* const utf8_words[] = {
+	"naïve", "café", "Müller", "façade", "señor", "Øresund", "Ελλάδα", "истории", "日本語", "中文"
+};
+
+// First words are capitalised and never look like a list marker or Roman numeral
+static const char* const first_words[] = {
+	"The", "Workers", "History", "Capital", "Labour", "Society", "Production", "Every", "Material", "Theory"
+};
+
+static const char* const list_markers[] = { "* ", "1. ", "a. ", "I. " };
+
+#define array_count(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint32_t gen_random(gen_context* ctx)
+{
+	// xorshift64*
+	ctx->random ^= ctx->random >> 12;
+	ctx->random ^= ctx->random << 25;
+	ctx->random ^= ctx->random >> 27;
+
+	return (uint32_t)((ctx->random * 0x2545F4914F6CDD1D) >> 32);
+}
+
+static uint32_t gen_range(gen_context* ctx, uint32_t count)
+{
+	return gen_random(ctx) % count;
+}
+
+static bool gen_chance(gen_context* ctx, uint32_t percent)
+{
+	return gen_range(ctx, 100) < percent;
+}
+
+static uint64_t gen_size(const gen_context* ctx)
+{
+	return ctx->flushed + ctx->out.size;
+}
+
+static void gen_flush(gen_context* ctx)
+{
+	if (fwrite(ctx->out.data, 1, ctx->out.size, ctx->f) != ctx->out.size)
+		handle_error("Unable to write output.");
+
+	ctx->flushed += ctx->out.size;
+	ctx->out.size = 0;
+}
+
+static void gen_string(gen_context* ctx, const char* string)
+{
+	print_string(&ctx->out, string);
+}
+
+// Every line ending goes through here so the whole document can switch to CRLF
+static void gen_newline(gen_context* ctx)
+{
+	gen_string(ctx, ctx->options->crlf ? "\r\n" : "\n");
+
+	if (ctx->out.size >= gen_flush_size)
+		gen_flush(ctx);
+}
+
+static void gen_word(gen_context* ctx)
+{
+	if (gen_chance(ctx, ctx->options->utf8_percent))
+		gen_string(ctx, utf8_words[gen_range(ctx, array_count(utf8_words))]);
+	else
+		gen_string(ctx, ascii_words[gen_range(ctx, array_count(ascii_words))]);
+}
+
+/*
+	Range comments are attached directly to the end of a word so removing them never leaves a double
+	space. Some span a line break to exercise line counting inside comments.
+*/
+static void gen_comment(gen_context* ctx)
+{
+	gen_string(ctx, "/*");
+	gen_word(ctx);
+	gen_string(ctx, " ");
+	gen_word(ctx);
+
+	if (gen_chance(ctx, 25))
+		gen_newline(ctx);
+	else
+		gen_string(ctx, " ");
+
+	gen_word(ctx);
+	gen_string(ctx, "*/");
+}
+
+// Writes a single line of text with decorations, references and comments, without the line ending
+static void gen_text(gen_context* ctx, uint32_t word_count, bool references)
+{
+	const gen_options* options = ctx->options;
+
+	gen_string(ctx, first_words[gen_range(ctx, array_count(first_words))]);
+
+	bool quoted = false;
+	for (uint32_t i = 1; i < word_count; ++i)
+	{
+		// Em dashes join words without spaces, everything else is separated by a single space
+		if (gen_chance(ctx, 2))
+			gen_string(ctx, "---");
+		else
+			gen_string(ctx, " ");
+
+		const uint32_t style = gen_range(ctx, 100);
+		const bool last_word = i + 1 == word_count;
+
+		if (!quoted && !last_word && style < 3)
+		{
+			gen_string(ctx, "\"");
+			quoted = true;
+		}
+
+		if (style >= 3 && style < 6)
+		{
+			gen_string(ctx, "*");
+			gen_word(ctx);
+			gen_string(ctx, "*");
+		}
+		else if (style >= 6 && style < 8)
+		{
+			gen_string(ctx, "**");
+			gen_word(ctx);
+			gen_string(ctx, "**");
+		}
+		else
+		{
+			gen_word(ctx);
+		}
+
+		if (quoted && (last_word || style >= 90))
+		{
+			gen_string(ctx, "\"");
+			quoted = false;
+		}
+
+		if (references && ctx->chapter_refs < gen_max_references && gen_chance(ctx, options->reference_percent))
+		{
+			char reference[16];
+			snprintf(reference, sizeof(reference), "[%u]", ++ctx->chapter_refs);
+			gen_string(ctx, reference);
+		}
+
+		if (gen_chance(ctx, options->comment_percent))
+			gen_comment(ctx);
+	}
+
+	gen_string(ctx, ".");
+}
+
+static uint32_t gen_paragraph_length(gen_context* ctx)
+{
+	// Vary lengths between half and one and a half times the average
+	const uint32_t average = ctx->options->paragraph_words;
+	return average / 2 + gen_range(ctx, average + 1) + 1;
+}
+
+static void gen_paragraph(gen_context* ctx)
+{
+	gen_text(ctx, gen_paragraph_length(ctx), true);
+	gen_newline(ctx);
+	gen_newline(ctx);
+}
+
+static void gen_list(gen_context* ctx)
+{
+	const uint32_t item_count = ctx->options->list_items;
+
+	// Letter and Roman numeral lists only go up to 26 items, and numbered lists to 998
+	uint32_t type = gen_range(ctx, array_count(list_markers));
+	if ((type == 2 && item_count > gen_max_letter_items) || (type == 3 && item_count > gen_max_roman_items))
+		type = 1;
+	if (type == 1 && item_count > gen_max_arabic_items)
+		type = 0;
+
+	for (uint32_t i = 0; i < item_count; ++i)
+	{
+		char marker[16];
+		if (type == 1)
+			snprintf(marker, sizeof(marker), "%u. ", i + 1);
+		else if (type == 2)
+			snprintf(marker, sizeof(marker), "%c. ", 'a' + i);
+		else if (type == 3)
+			snprintf(marker, sizeof(marker), "%s. ", roman_upper_strings[i]);
+		else
+			snprintf(marker, sizeof(marker), "%s", list_markers[0]);
+
+		gen_string(ctx, marker);
+		gen_text(ctx, 2 + gen_range(ctx, 10), false);
+		gen_newline(ctx);
+	}
+
+	gen_newline(ctx);
+}
+
+static void gen_blockquote(gen_context* ctx)
+{
+	const uint32_t paragraph_count = 1 + gen_range(ctx, ctx->options->blockquote_paragraphs);
+
+	for (uint32_t i = 0; i < paragraph_count; ++i)
+	{
+		if (i)
+		{
+			gen_string(ctx, "\t");
+			gen_newline(ctx);
+		}
+
+		gen_string(ctx, "\t");
+		gen_text(ctx, gen_paragraph_length(ctx), true);
+		gen_newline(ctx);
+	}
+
+	if (gen_chance(ctx, 50))
+	{
+		gen_string(ctx, "\t");
+		gen_newline(ctx);
+		gen_string(ctx, "\t---");
+		gen_text(ctx, 2 + gen_range(ctx, 4), false);
+		gen_newline(ctx);
+	}
+
+	gen_newline(ctx);
+}
+
+static void gen_chapter(gen_context* ctx, uint32_t index, uint64_t end_size)
+{
+	const gen_options* options = ctx->options;
+
+	char heading[64];
+	snprintf(heading, sizeof(heading), "# Chapter %u", index + 1);
+	gen_string(ctx, heading);
+	gen_newline(ctx);
+	gen_newline(ctx);
+
+	ctx->chapter_refs = 0;
+
+	uint32_t section = 0;
+	uint32_t block = 0;
+	do
+	{
+		// Start a new section every few blocks, sometimes with a subsection
+		if (block && block % 8 == 0)
+		{
+			snprintf(heading, sizeof(heading), gen_chance(ctx, 25) ? "### Part %u.%u" : "## Section %u.%u", index + 1, ++section);
+			gen_string(ctx, heading);
+			gen_newline(ctx);
+			gen_newline(ctx);
+		}
+
+		const uint32_t kind = gen_range(ctx, 100);
+		if (kind < options->list_percent)
+			gen_list(ctx);
+		else if (kind < options->list_percent + options->blockquote_percent)
+			gen_blockquote(ctx);
+		else
+			gen_paragraph(ctx);
+
+		++block;
+	} while (gen_size(ctx) < end_size);
+
+	// Every inline reference is defined at the end of its chapter
+	for (uint32_t i = 0; i < ctx->chapter_refs; ++i)
+	{
+		char reference[16];
+		snprintf(reference, sizeof(reference), "[%u] ", i + 1);
+		gen_string(ctx, reference);
+		gen_text(ctx, 4 + gen_range(ctx, 16), false);
+		gen_newline(ctx);
+		gen_newline(ctx);
+	}
+}
+
+static void print_gen_usage(void)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"  press_gen [options] [out.txt]\n"
+		"\n"
+		"Writes to stdout when no output file is given.\n"
+		"\n"
+		"Options:\n"
+		"  --size=<n>[K|M|G]        approximate output size, default 1M\n"
+		"  --chapters=<n>           number of chapters, default 10\n"
+		"  --paragraph=<n>          average words per paragraph, default 80\n"
+		"  --lists=<0-100>          percentage of blocks that are lists, default 10\n"
+		"  --list-items=<n>         items per list, default 5\n"
+		"  --blockquotes=<0-100>    percentage of blocks that are block quotes, default 5\n"
+		"  --quote-paragraphs=<n>   maximum paragraphs per block quote, default 3\n"
+		"  --references=<0-100>     percentage of words followed by a reference, default 1\n"
+		"  --utf8=<0-100>           percentage of words with multi-byte UTF-8 characters, default 5\n"
+		"  --comments=<0-100>       percentage of words followed by a range comment, default 1\n"
+		"  --seed=<n>               random seed, default 1\n"
+		"  --crlf                   use CRLF line endings\n"
+	);
+
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t parse_number(const char* arg, const char* value, bool allow_suffix)
+{
+	char* end;
+	uint64_t number = strtoull(value, &end, 10);
+
+	if (allow_suffix && *end)
+	{
+		if (*end == 'K' || *end == 'k')
+			number <<= 10;
+		else if (*end == 'M' || *end == 'm')
+			number <<= 20;
+		else if (*end == 'G' || *end == 'g')
+			number <<= 30;
+		else
+			--end;
+
+		++end;
+	}
+
+	if (end == value || *end)
+		handle_error("Invalid value for \"%s\".", arg);
+
+	return number;
+}
+
+static uint32_t parse_percent(const char* arg, const char* value)
+{
+	const uint64_t percent = parse_number(arg, value, false);
+	if (percent > 100)
+		handle_error("\"%s\" must be a percentage from 0 to 100.", arg);
+
+	return (uint32_t)percent;
+}
+
+static bool match_option(const char* arg, const char* name, const char** out_value)
+{
+	const size_t len = strlen(name);
+	if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+		return false;
+
+	*out_value = arg + len + 1;
+	return true;
+}
+
+int main(int argc, const char** argv)
+{
+	gen_options options = {
+		.size					= 1 << 20,
+		.chapters				= 10,
+		.paragraph_words		= 80,
+		.list_percent			= 10,
+		.list_items				= 5,
+		.blockquote_percent		= 5,
+		.blockquote_paragraphs	= 3,
+		.reference_percent		= 1,
+		.utf8_percent			= 5,
+		.comment_percent		= 1,
+		.seed					= 1
+	};
+	const char* output_path = nullptr;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value;
+
+		if (strcmp(arg, "--crlf") == 0)
+			options.crlf = true;
+		else if (match_option(arg, "--size", &value))
+			options.size = parse_number(arg, value, true);
+		else if (match_option(arg, "--chapters", &value))
+			options.chapters = (uint32_t)parse_number(arg, value, false);
+		else if (match_option(arg, "--paragraph", &value))
+			options.paragraph_words = (uint32_t)parse_number(arg, value, false);
+		else if (match_option(arg, "--lists", &value))
+			options.list_percent = parse_percent(arg, value);
+		else if (match_option(arg, "--list-items", &value))
+			options.list_items = (uint32_t)parse_number(arg, value, false);
+		else if (match_option(arg, "--blockquotes", &value))
+			options.blockquote_percent = parse_percent(arg, value);
+		else if (match_option(arg, "--quote-paragraphs", &value))
+			options.blockquote_paragraphs = (uint32_t)parse_number(arg, value, false);
+		else if (match_option(arg, "--references", &value))
+			options.reference_percent = parse_percent(arg, value);
+		else if (match_option(arg, "--utf8", &value))
+			options.utf8_percent = parse_percent(arg, value);
+		else if (match_option(arg, "--comments", &value))
+			options.comment_percent = parse_percent(arg, value);
+		else if (match_option(arg, "--seed", &value))
+			options.seed = (uint32_t)parse_number(arg, value, false);
+		else if (*arg == '-' || output_path)
+			print_gen_usage();
+		else
+			output_path = arg;
+	}
+
+	if (options.chapters == 0 || options.paragraph_words == 0 || options.list_items == 0 || options.blockquote_paragraphs == 0)
+		handle_error("Chapters, paragraph length, list items and quote paragraphs must be at least 1.");
+	if (options.list_percent + options.blockquote_percent > 100)
+		handle_error("Lists and block quotes together cannot exceed 100%%.");
+
+	gen_context ctx = {
+		.options	= &options,
+		.f			= output_path ? open_file(output_path, file_mode_write) : stdout,
+		.random		= ((uint64_t)options.seed << 32) | 0x9E3779B9	// Never zero
+	};
+
+	gen_string(&ctx, options.chapters > 1 ? "[Type:\tBook]" : "[Type:\tArticle]");
+	gen_newline(&ctx);
+	gen_string(&ctx, "[Title:\tPress Stress Test]");
+	gen_newline(&ctx);
+	gen_string(&ctx, "[Author:\tPress Generator]");
+	gen_newline(&ctx);
+	gen_newline(&ctx);
+
+	const uint64_t chapter_size = options.size / options.chapters;
+	for (uint32_t i = 0; i < options.chapters; ++i)
+		gen_chapter(&ctx, i, chapter_size * (i + 1));
+
+	gen_flush(&ctx);
+
+	if (output_path)
+		fclose(ctx.f);
+
+	return EXIT_SUCCESS;
+}